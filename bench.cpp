@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench_contention.h"
+#include "bench_footprint.h"
+#include "bench_harness.h"
+#include "bench_macro.h"
+#include "bench_micro.h"
+
+static const char kUsage[] =
+    " [--suite micro,contention,macro,footprint] [--filter TEXT] [--samples N] [--min-time-ms MS] [--json FILE]"
+    " [--threads N,N,...] [--ops N] [--csv FILE] [--seed N] [--scale F] [--macro-csv FILE] [--objects N]"
+    " [--footprint-csv FILE] [--no-perf]\n";
+
+static std::vector<std::string> SplitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    for (std::string item; std::getline(stream, item, ',');) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// Usage: my_shared_ptr_bench [--suite micro,contention,macro,footprint] [--filter TEXT]
+//     [--samples N] [--min-time-ms MS] [--json FILE] [--threads N,N,...] [--ops N] [--csv FILE]
+//     [--seed N] [--scale F] [--macro-csv FILE] [--objects N] [--footprint-csv FILE] [--no-perf]
+// --json takes the micro results, --csv the contention sweep, --macro-csv the macro scenarios
+// and --footprint-csv the footprint table
+int main(int argc, char** argv) {
+    Harness::Options options;
+    ContentionBenchmarks::Options contention;
+    MacroBenchmarks::Options macro;
+    FootprintBenchmarks::Options footprint;
+    std::vector<std::string> suites = {"micro"};
+    std::string json_path;
+    std::string csv_path;
+    std::string macro_csv_path;
+    std::string footprint_csv_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << '\n';
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--suite") {
+            suites = SplitList(value());
+        } else if (arg == "--filter") {
+            options.filter = value();
+        } else if (arg == "--samples") {
+            options.samples = std::stoul(value());
+        } else if (arg == "--min-time-ms") {
+            options.min_sample_time_ns = std::stod(value()) * 1e6;
+        } else if (arg == "--no-perf") {
+            options.perf_counters = false;
+        } else if (arg == "--json") {
+            json_path = value();
+        } else if (arg == "--threads") {
+            contention.threads.clear();
+            for (const auto& count : SplitList(value())) {
+                contention.threads.push_back(std::stoul(count));
+            }
+        } else if (arg == "--ops") {
+            contention.ops_per_thread = std::stoul(value());
+        } else if (arg == "--csv") {
+            csv_path = value();
+        } else if (arg == "--seed") {
+            macro.seed = std::stoull(value());
+        } else if (arg == "--scale") {
+            macro.scale = std::stod(value());
+        } else if (arg == "--macro-csv") {
+            macro_csv_path = value();
+        } else if (arg == "--objects") {
+            footprint.objects = std::max<size_t>(2, std::stoul(value()));
+        } else if (arg == "--footprint-csv") {
+            footprint_csv_path = value();
+        } else {
+            std::cerr << "usage: " << argv[0] << kUsage;
+            return 2;
+        }
+    }
+    auto enabled = [&](const std::string& suite) {
+        return std::find(suites.begin(), suites.end(), suite) != suites.end();
+    };
+
+    Harness harness(options);
+    if (enabled("micro")) {
+        MicroBenchmarks::Run(harness);
+    }
+    std::vector<ContentionBenchmarks::Row> rows;
+    if (enabled("contention")) {
+        rows = ContentionBenchmarks::Run(harness, contention);
+    }
+    std::vector<MacroBenchmarks::Row> macro_rows;
+    if (enabled("macro")) {
+        macro_rows = MacroBenchmarks::Run(harness, macro);
+    }
+    std::vector<FootprintBenchmarks::Row> footprint_rows;
+    if (enabled("footprint")) {
+        footprint_rows = FootprintBenchmarks::Run(harness, footprint);
+    }
+    std::vector<FootprintBenchmarks::LargeRow> large_rows;
+    if (enabled("footprint")) {
+        large_rows = FootprintBenchmarks::RunLarge(harness, footprint);
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream json(json_path);
+        harness.WriteJson(json);
+        if (!json) {
+            std::cerr << "failed to write " << json_path << '\n';
+            return 1;
+        }
+    }
+    if (!csv_path.empty()) {
+        std::ofstream csv(csv_path);
+        ContentionBenchmarks::WriteCsv(rows, csv);
+        if (!csv) {
+            std::cerr << "failed to write " << csv_path << '\n';
+            return 1;
+        }
+    }
+    if (!macro_csv_path.empty()) {
+        std::ofstream csv(macro_csv_path);
+        MacroBenchmarks::WriteCsv(macro_rows, csv);
+        if (!csv) {
+            std::cerr << "failed to write " << macro_csv_path << '\n';
+            return 1;
+        }
+    }
+    if (!footprint_csv_path.empty()) {
+        std::ofstream csv(footprint_csv_path);
+        FootprintBenchmarks::WriteCsv(footprint_rows, csv);
+        csv << '\n';
+        FootprintBenchmarks::WriteCsv(large_rows, csv);
+        if (!csv) {
+            std::cerr << "failed to write " << footprint_csv_path << '\n';
+            return 1;
+        }
+    }
+}
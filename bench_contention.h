@@ -0,0 +1,206 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_harness.h"
+#include "shared.h"
+
+// Reference counting under contention: 1..N threads, each pinned to its own CPU (round robin
+// over the allowed set when there are more threads than CPUs), copy and drop a pointer in a
+// loop. In the "shared" scenario every thread copies the same pointer, so all of them write
+// the same control block; in "private" each thread has its own object. Every copy+drop pair is
+// timed with CycleClock into a per-thread LatencyHistogram, merged after the run.
+// The sweep covers thread counts and counting policies and is written as CSV:
+//     policy,sharing,threads,ops,throughput_mops,p50_ns,p99_ns,p999_ns,max_ns
+// Timestamps cost a few ns themselves, compare rows with each other rather than with
+// MicroBenchmarks.
+
+struct AtomicCountPolicy {
+    static constexpr const char* kName = "SharedPtr";
+
+    using Ptr = SharedPtr<uint64_t>;
+
+    static Ptr Make() {
+        return MakeShared<uint64_t>(0);
+    }
+};
+
+// Immortal control blocks are never written by copies; each run leaks its objects
+struct ImmortalPolicy {
+    static constexpr const char* kName = "SharedPtr/immortal";
+
+    using Ptr = SharedPtr<uint64_t>;
+
+    static Ptr Make() {
+        auto ptr = MakeShared<uint64_t>(0);
+        ptr.MakeImmortal();
+        return ptr;
+    }
+};
+
+struct StdSharedPtrPolicy {
+    static constexpr const char* kName = "std::shared_ptr";
+
+    using Ptr = std::shared_ptr<uint64_t>;
+
+    static Ptr Make() {
+        return std::make_shared<uint64_t>(0);
+    }
+};
+
+class ContentionBenchmarks {
+public:
+    struct Options {
+        // Empty: 1, 2, 4, ... up to the number of allowed CPUs, and that number itself
+        std::vector<size_t> threads;
+        size_t ops_per_thread = 1 << 20;
+    };
+
+    struct Row {
+        std::string policy;
+        std::string sharing;
+        size_t threads;
+        size_t ops;
+        double throughput_mops;
+        double p50_ns;
+        double p99_ns;
+        double p999_ns;
+        double max_ns;
+    };
+
+    // Rows are selected by the harness filter on "contention/<sharing>/<policy>"
+    static std::vector<Row> Run(const Harness& harness, const Options& options) {
+        std::vector<Row> rows;
+        std::vector<size_t> sweep = options.threads.empty() ? DefaultSweep() : options.threads;
+        for (const char* sharing : {"shared", "private"}) {
+            bool shared = sharing[0] == 's';
+            for (size_t threads : sweep) {
+                RunPolicy<AtomicCountPolicy>(harness, sharing, shared, threads, options, &rows);
+                RunPolicy<ImmortalPolicy>(harness, sharing, shared, threads, options, &rows);
+                RunPolicy<StdSharedPtrPolicy>(harness, sharing, shared, threads, options, &rows);
+            }
+        }
+        return rows;
+    }
+
+    static void WriteCsv(const std::vector<Row>& rows, std::ostream& out) {
+        out << "policy,sharing,threads,ops,throughput_mops,p50_ns,p99_ns,p999_ns,max_ns\n";
+        for (const auto& row : rows) {
+            out << row.policy << ',' << row.sharing << ',' << row.threads << ',' << row.ops << ','
+                << row.throughput_mops << ',' << row.p50_ns << ',' << row.p99_ns << ',' << row.p999_ns << ','
+                << row.max_ns << '\n';
+        }
+    }
+
+    // CPUs this process may run on, in increasing order
+    static std::vector<int> AllowedCpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (::sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+        return cpus;
+    }
+
+private:
+    static std::vector<size_t> DefaultSweep() {
+        size_t cpus = std::max<size_t>(1, AllowedCpus().size());
+        std::vector<size_t> sweep;
+        for (size_t threads = 1; threads < cpus; threads *= 2) {
+            sweep.push_back(threads);
+        }
+        sweep.push_back(cpus);
+        return sweep;
+    }
+
+    // Best effort: without permission the thread simply stays unpinned
+    static void Pin(int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ::sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    template <typename Policy>
+    static void RunPolicy(const Harness& harness, const char* sharing, bool shared, size_t threads,
+                          const Options& options, std::vector<Row>* rows) {
+        if (!harness.Selected("contention", sharing, Policy::kName)) {
+            return;
+        }
+        std::vector<int> cpus = AllowedCpus();
+        typename Policy::Ptr common = Policy::Make();
+        std::vector<LatencyHistogram> histograms(threads);
+        std::atomic<size_t> ready{0};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back([&, i] {
+                if (!cpus.empty()) {
+                    Pin(cpus[i % cpus.size()]);
+                }
+                typename Policy::Ptr object = shared ? common : Policy::Make();
+                // Thread-local until the end, so recording never shares cache lines
+                LatencyHistogram histogram;
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                for (size_t op = 0; op < options.ops_per_thread; ++op) {
+                    uint64_t start = CycleClock::Now();
+                    {
+                        typename Policy::Ptr copy = object;
+                        DoNotOptimize(copy);
+                    }
+                    histogram.Record(CycleClock::Now() - start);
+                }
+                histograms[i] = histogram;
+            });
+        }
+        while (ready.load() < threads) {
+            std::this_thread::yield();
+        }
+        Stopwatch watch;
+        go.store(true, std::memory_order_release);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double elapsed_ns = watch.ElapsedNs();
+
+        auto histogram = std::make_unique<LatencyHistogram>();
+        for (const auto& part : histograms) {
+            histogram->Merge(part);
+        }
+        double ns_per_tick = CycleClock::NsPerTick();
+        size_t ops = threads * options.ops_per_thread;
+        Row row{Policy::kName,
+                sharing,
+                threads,
+                ops,
+                ops / elapsed_ns * 1e3,
+                histogram->Percentile(0.5) * ns_per_tick,
+                histogram->Percentile(0.99) * ns_per_tick,
+                histogram->Percentile(0.999) * ns_per_tick,
+                histogram->Max() * ns_per_tick};
+        std::fprintf(stderr, "%-10s %-8s %-18s %3zu thr %8.2f Mops/s p50 %6.1f p99 %7.1f p99.9 %8.1f max %10.1f ns\n",
+                     "contention", sharing, Policy::kName, threads, row.throughput_mops, row.p50_ns, row.p99_ns,
+                     row.p999_ns, row.max_ns);
+        rows->push_back(std::move(row));
+    }
+};
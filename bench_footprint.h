@@ -0,0 +1,286 @@
+#pragma once
+
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "bench_harness.h"
+#include "bench_micro.h"
+#include "block_pool.h"
+#include "shared.h"
+
+// Memory footprint of N live objects per construction path and payload size. Each measurement
+// runs in a forked child, so freed memory and pool free lists of earlier ones do not hide or
+// inflate its numbers. Per object it reports
+//   - heap: bytes malloc holds for it (mallinfo2 in-use, including chunk headers and rounding)
+//   - overhead: heap minus the payload, i.e. control block and allocator overhead
+//   - rss: growth of the resident set (/proc/self/statm), handle included, which also covers
+//     memory mapped around malloc
+//   - retained: heap still held per surviving object after every other one is dropped, which
+//     shows fragmentation and memory kept in pools
+// plus the size of one handle. The handles live in a vector reserved before the baseline.
+// Paths: SharedPtr(new T), MakeShared, MakeSharedPooled, "arena" (one MakeShared<T[]> with an
+// aliasing SharedPtr per element) and std::make_shared for reference.
+// A second table compares payloads below and above the LargeObjects threshold on the default
+// path (mapped directly from 1 MiB) and with everything left to malloc: resident set and minor
+// page faults per object while alive, and resident bytes per object still held after all of
+// them are dropped.
+class FootprintBenchmarks {
+public:
+    struct Options {
+        size_t objects = 100000;
+        size_t large_objects = 32;
+    };
+
+    struct Row {
+        std::string path;
+        size_t payload;
+        size_t objects;
+        size_t handle_bytes;
+        double heap_bytes;
+        double overhead_bytes;
+        double rss_bytes;
+        double retained_bytes;
+    };
+
+    struct LargeRow {
+        std::string path;
+        size_t payload;
+        size_t objects;
+        double rss_bytes;
+        double minor_faults;
+        double rss_after_free_bytes;
+    };
+
+    // Selected by the harness filter on "footprint/large/<path>/<payload>"
+    static std::vector<LargeRow> RunLarge(const Harness& harness, const Options& options) {
+        std::vector<LargeRow> rows;
+        RunLargePayload<256 * 1024>(harness, options, &rows);
+        RunLargePayload<1024 * 1024>(harness, options, &rows);
+        RunLargePayload<4 * 1024 * 1024>(harness, options, &rows);
+        if (!rows.empty()) {
+            std::fprintf(stderr, "%-10s %-18s %9s %8s %12s %12s %14s\n", "footprint", "large path", "payload",
+                         "objects", "rss/obj", "faults/obj", "rss after free");
+            for (const auto& row : rows) {
+                std::fprintf(stderr, "%-10s %-18s %9zu %8zu %12.0f %12.1f %14.0f\n", "footprint", row.path.c_str(),
+                             row.payload, row.objects, row.rss_bytes, row.minor_faults, row.rss_after_free_bytes);
+            }
+        }
+        return rows;
+    }
+
+    // Selected by the harness filter on "footprint/<path>/<payload>"
+    static std::vector<Row> Run(const Harness& harness, const Options& options) {
+        std::vector<Row> rows;
+        RunPayload<1>(harness, options, &rows);
+        RunPayload<8>(harness, options, &rows);
+        RunPayload<64>(harness, options, &rows);
+        RunPayload<256>(harness, options, &rows);
+        RunPayload<1024>(harness, options, &rows);
+        RunPayload<4096>(harness, options, &rows);
+        if (!rows.empty()) {
+            std::fprintf(stderr, "%-10s %-18s %7s %10s %8s %10s %10s %10s %10s\n", "footprint", "path", "payload",
+                         "objects", "handle", "heap/obj", "overhead", "rss/obj", "retained");
+            for (const auto& row : rows) {
+                std::fprintf(stderr, "%-10s %-18s %7zu %10zu %8zu %10.1f %10.1f %10.1f %10.1f\n", "footprint",
+                             row.path.c_str(), row.payload, row.objects, row.handle_bytes, row.heap_bytes,
+                             row.overhead_bytes, row.rss_bytes, row.retained_bytes);
+            }
+        }
+        return rows;
+    }
+
+    static void WriteCsv(const std::vector<Row>& rows, std::ostream& out) {
+        out << "path,payload,objects,handle_bytes,heap_bytes,overhead_bytes,rss_bytes,retained_bytes\n";
+        for (const auto& row : rows) {
+            out << row.path << ',' << row.payload << ',' << row.objects << ',' << row.handle_bytes << ','
+                << row.heap_bytes << ',' << row.overhead_bytes << ',' << row.rss_bytes << ',' << row.retained_bytes
+                << '\n';
+        }
+    }
+
+    static void WriteCsv(const std::vector<LargeRow>& rows, std::ostream& out) {
+        out << "path,payload,objects,rss_bytes,minor_faults,rss_after_free_bytes\n";
+        for (const auto& row : rows) {
+            out << row.path << ',' << row.payload << ',' << row.objects << ',' << row.rss_bytes << ','
+                << row.minor_faults << ',' << row.rss_after_free_bytes << '\n';
+        }
+    }
+
+private:
+    struct Usage {
+        size_t in_use;
+        size_t held;
+        size_t resident;
+        size_t minor_faults;
+
+        static Usage Now() {
+            struct mallinfo2 info = ::mallinfo2();
+            size_t pages = 0, resident = 0;
+            std::ifstream("/proc/self/statm") >> pages >> resident;
+            struct rusage usage;
+            ::getrusage(RUSAGE_SELF, &usage);
+            return {info.uordblks + info.hblkhd, info.arena + info.hblkhd,
+                    resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE)), static_cast<size_t>(usage.ru_minflt)};
+        }
+    };
+
+    static double Grown(size_t after, size_t before) {
+        return static_cast<double>(after) - static_cast<double>(before);
+    }
+
+    // Runs `measure()` in a forked child and returns its trivially copyable result through a
+    // pipe; false if the child failed
+    template <typename Result, typename Measure>
+    static bool InChild(Measure measure, Result* result) {
+        int fds[2];
+        if (::pipe(fds) != 0) {
+            std::perror("pipe");
+            return false;
+        }
+        std::fflush(stderr);
+        pid_t child = ::fork();
+        if (child < 0) {
+            std::perror("fork");
+            ::close(fds[0]);
+            ::close(fds[1]);
+            return false;
+        }
+        if (child == 0) {
+            ::close(fds[0]);
+            Result value = measure();
+            bool ok = ::write(fds[1], &value, sizeof(value)) == sizeof(value);
+            ::_exit(ok ? 0 : 1);
+        }
+        ::close(fds[1]);
+        bool ok = ::read(fds[0], result, sizeof(Result)) == sizeof(Result);
+        ::close(fds[0]);
+        int status = 0;
+        ::waitpid(child, &status, 0);
+        return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    // Sent from the child through a pipe, in bytes for all objects
+    struct Measurement {
+        double heap;
+        double rss;
+        double retained;
+    };
+
+    template <size_t N>
+    static void RunPayload(const Harness& harness, const Options& options, std::vector<Row>* rows) {
+        using P = Payload<N>;
+        using Ptr = SharedPtr<P>;
+        Measure<Ptr>(harness, "SharedPtr(new T)", N, options, rows, [](size_t) { return Ptr(new P); });
+        Measure<Ptr>(harness, "MakeShared", N, options, rows, [](size_t) { return MakeShared<P>(); });
+        Measure<Ptr>(harness, "MakeSharedPooled", N, options, rows, [](size_t) { return MakeSharedPooled<P>(); });
+        SharedPtr<P[]> arena;
+        Measure<Ptr>(harness, "arena", N, options, rows, [&](size_t i) {
+            if (!arena) {
+                // Only in the child: keeps the arena on malloc (which maps it just the same) so
+                // that mallinfo sees it
+                LargeObjects::SetThreshold(SIZE_MAX);
+                arena = MakeShared<P[]>(options.objects);
+            }
+            return Ptr(arena, &arena[i]);
+        });
+        Measure<std::shared_ptr<P>>(harness, "std::make_shared", N, options, rows,
+                                    [](size_t) { return std::make_shared<P>(); });
+    }
+
+    template <typename Handle, typename Make>
+    static void Measure(const Harness& harness, const char* path, size_t payload, const Options& options,
+                        std::vector<Row>* rows, Make make) {
+        if (!harness.Selected("footprint", path, std::to_string(payload))) {
+            return;
+        }
+        Measurement measurement;
+        if (!InChild([&] { return Child<Handle>(options.objects, make); }, &measurement)) {
+            std::fprintf(stderr, "footprint %s %zu B: measurement failed\n", path, payload);
+            return;
+        }
+        double objects = static_cast<double>(options.objects);
+        rows->push_back({path, payload, options.objects, sizeof(Handle), measurement.heap / objects,
+                         measurement.heap / objects - payload, measurement.rss / objects,
+                         measurement.retained / (objects - objects / 2)});
+    }
+
+    template <typename Handle, typename Make>
+    static Measurement Child(size_t objects, Make& make) {
+        std::vector<Handle> handles;
+        handles.reserve(objects);
+        Usage before = Usage::Now();
+        for (size_t i = 0; i < objects; ++i) {
+            handles.push_back(make(i));
+        }
+        Usage live = Usage::Now();
+        for (size_t i = 0; i < objects; i += 2) {
+            handles[i] = nullptr;
+        }
+        Usage half = Usage::Now();
+        return {Grown(live.in_use, before.in_use), Grown(live.resident, before.resident),
+                Grown(half.held, before.held)};
+    }
+
+    template <size_t N>
+    static void RunLargePayload(const Harness& harness, const Options& options, std::vector<LargeRow>* rows) {
+        for (bool mapped : {true, false}) {
+            const char* path = mapped ? "MakeShared" : "MakeShared/malloc";
+            if (!harness.Selected("footprint", std::string("large/") + path, std::to_string(N))) {
+                continue;
+            }
+            LargeMeasurement measurement;
+            bool ok = InChild(
+                [&] {
+                    if (!mapped) {
+                        LargeObjects::SetThreshold(SIZE_MAX);
+                    }
+                    return LargeChild<N>(options.large_objects);
+                },
+                &measurement);
+            if (!ok) {
+                std::fprintf(stderr, "footprint large %s %zu B: measurement failed\n", path, N);
+                continue;
+            }
+            double objects = static_cast<double>(options.large_objects);
+            rows->push_back({path, N, options.large_objects, measurement.rss / objects,
+                             measurement.minor_faults / objects, measurement.rss_after_free / objects});
+        }
+    }
+
+    struct LargeMeasurement {
+        double rss;
+        double minor_faults;
+        double rss_after_free;
+    };
+
+    // Objects are value-initialized, so every page is touched. One object of the same size is
+    // created and dropped first, as in a process that has been running for a while: glibc raises
+    // its own mmap threshold past the size of a freed mapped chunk.
+    template <size_t N>
+    static LargeMeasurement LargeChild(size_t objects) {
+        using P = Payload<N>;
+        MakeShared<P>();
+        std::vector<SharedPtr<P>> handles;
+        handles.reserve(objects);
+        Usage before = Usage::Now();
+        for (size_t i = 0; i < objects; ++i) {
+            handles.push_back(MakeShared<P>());
+        }
+        Usage live = Usage::Now();
+        handles.clear();
+        Usage freed = Usage::Now();
+        return {Grown(live.resident, before.resident), Grown(live.minor_faults, before.minor_faults),
+                Grown(freed.resident, before.resident)};
+    }
+};
@@ -0,0 +1,477 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Minimal self-contained benchmark harness.
+// A benchmark is a function that runs `iterations` operations and returns the nanoseconds they
+// took, so it can keep setup and teardown out of the measurement. The harness picks the
+// iteration count so one sample takes at least `min_sample_time`, takes `samples` samples and
+// reports the mean time per operation with a 95% confidence interval. Where perf_event_open
+// works, hardware counters are read over the same timed regions and reported per operation.
+
+template <typename T>
+inline void DoNotOptimize(T& value) {
+    asm volatile("" : "+m"(value) : : "memory");
+}
+
+inline void ClobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+// Per-thread hardware counters through perf_event_open, user space only. Each event is opened
+// on its own, so events the CPU, the kernel or the container does not provide are simply
+// missing; when there are more events than counters the kernel multiplexes them and values are
+// scaled by the time each one actually ran.
+// All of the thread's counters are switched on and off together with one prctl, which is what
+// Stopwatch does while counters are Active().
+class PerfCounters {
+public:
+    struct Event {
+        const char* name;
+        uint32_t type;
+        uint64_t config;
+    };
+
+    PerfCounters() {
+        for (const Event& event : Events()) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = event.type;
+            attr.config = event.config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+            if (fd >= 0) {
+                counters_.push_back({event.name, fd});
+            } else {
+                missing_.push_back(event.name);
+            }
+        }
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+        if (Active() == this) {
+            Active() = nullptr;
+        }
+        for (const auto& counter : counters_) {
+            ::close(counter.fd);
+        }
+    }
+
+    bool Empty() const {
+        return counters_.empty();
+    }
+
+    // Names of the events that could not be opened
+    const std::vector<std::string>& Missing() const {
+        return missing_;
+    }
+
+    // Counters Stopwatch drives on this thread, if any
+    static PerfCounters*& Active() {
+        static thread_local PerfCounters* active = nullptr;
+        return active;
+    }
+
+    static void Enable() {
+        ::prctl(PR_TASK_PERF_EVENTS_ENABLE, 0, 0, 0, 0);
+    }
+
+    static void Disable() {
+        ::prctl(PR_TASK_PERF_EVENTS_DISABLE, 0, 0, 0, 0);
+    }
+
+    // Scaled totals since construction, by event name; an event that never got a hardware
+    // counter is left out
+    std::vector<std::pair<std::string, double>> Read() const {
+        std::vector<std::pair<std::string, double>> values;
+        for (const auto& counter : counters_) {
+            uint64_t data[3];
+            if (::read(counter.fd, data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+                continue;
+            }
+            values.emplace_back(counter.name, static_cast<double>(data[0]) * data[1] / data[2]);
+        }
+        return values;
+    }
+
+private:
+    struct Counter {
+        std::string name;
+        int fd;
+    };
+
+    static std::vector<Event> Events() {
+        auto cache = [](uint64_t cache, uint64_t op, uint64_t result) { return cache | op << 8 | result << 16; };
+        std::vector<Event> events = {
+            {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {"l1d_misses", PERF_TYPE_HW_CACHE,
+             cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+            {"llc_misses", PERF_TYPE_HW_CACHE,
+             cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+            {"dtlb_misses", PERF_TYPE_HW_CACHE,
+             cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        };
+        // Loads served by a modified line in another core's cache, i.e. cache line transfers.
+        // There is no generic event for it; 0xd2/0x04 (MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM, later
+        // XSNP_FWD) has been stable across Intel cores since Haswell.
+        if (CpuVendor() == "GenuineIntel") {
+            events.push_back({"hitm", PERF_TYPE_RAW, 0x04d2});
+        }
+        return events;
+    }
+
+    static std::string CpuVendor() {
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        for (std::string line; std::getline(cpuinfo, line);) {
+            if (line.rfind("vendor_id", 0) == 0) {
+                return line.substr(line.find(':') + 2);
+            }
+        }
+        return "";
+    }
+
+    std::vector<Counter> counters_;
+    std::vector<std::string> missing_;
+};
+
+// Also brackets the thread's active PerfCounters: they run from construction to the first
+// ElapsedNs, outside the timed interval
+class Stopwatch {
+public:
+    Stopwatch() {
+        if (PerfCounters::Active()) {
+            PerfCounters::Enable();
+        }
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    double ElapsedNs() const {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        if (PerfCounters::Active()) {
+            PerfCounters::Disable();
+        }
+        return std::chrono::duration<double, std::nano>(elapsed).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Cheap per-operation timestamps: the TSC where there is one, steady_clock elsewhere
+class CycleClock {
+public:
+    static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    // Measured once against steady_clock
+    static double NsPerTick() {
+        static const double ns_per_tick = [] {
+            Stopwatch watch;
+            uint64_t start = Now();
+            while (watch.ElapsedNs() < 2e7) {
+            }
+            return watch.ElapsedNs() / static_cast<double>(Now() - start);
+        }();
+        return ns_per_tick;
+    }
+};
+
+// HDR-style log-linear histogram of non-negative integers (e.g. CycleClock ticks): values
+// below kSubBuckets are counted exactly, larger ones in kSubBuckets / 2 linear steps per power
+// of two, so any reported percentile is within 2 / kSubBuckets of the true value
+class LatencyHistogram {
+public:
+    static constexpr size_t kSubBucketBits = 6;
+    static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+
+    void Record(uint64_t value) {
+        ++counts_[Index(value)];
+        ++count_;
+        max_ = std::max(max_, value);
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t Count() const {
+        return count_;
+    }
+
+    uint64_t Max() const {
+        return max_;
+    }
+
+    // Upper bound of the bucket holding the `quantile` (0..1) value, at most Max()
+    uint64_t Percentile(double quantile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        auto rank = std::min(count_ - 1, static_cast<uint64_t>(quantile * count_));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts_[i];
+            if (seen > rank) {
+                return std::min(UpperBound(i), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    static constexpr size_t kHalf = kSubBuckets / 2;
+    static constexpr size_t kBuckets = kSubBuckets + (64 - kSubBucketBits) * kHalf;
+
+    static size_t Index(uint64_t value) {
+        if (value < kSubBuckets) {
+            return value;
+        }
+        // value >> shift lands in [kHalf, kSubBuckets)
+        size_t shift = 64 - __builtin_clzll(value) - kSubBucketBits;
+        return kSubBuckets + (shift - 1) * kHalf + ((value >> shift) - kHalf);
+    }
+
+    static uint64_t UpperBound(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        size_t shift = (index - kSubBuckets) / kHalf + 1;
+        uint64_t top = (index - kSubBuckets) % kHalf + kHalf;
+        return top + 1 == kSubBuckets && shift == 64 - kSubBucketBits ? UINT64_MAX : ((top + 1) << shift) - 1;
+    }
+
+    uint64_t counts_[kBuckets]{};
+    uint64_t count_ = 0;
+    uint64_t max_ = 0;
+};
+
+// Mean with the half-width of its 95% confidence interval (Student's t)
+struct SampleStats {
+    double mean = 0;
+    double stddev = 0;
+    double ci95 = 0;
+    double min = 0;
+    double max = 0;
+
+    static SampleStats Of(const std::vector<double>& samples) {
+        SampleStats stats;
+        if (samples.empty()) {
+            return stats;
+        }
+        double sum = 0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        stats.mean = sum / samples.size();
+        double squares = 0;
+        for (double sample : samples) {
+            squares += (sample - stats.mean) * (sample - stats.mean);
+        }
+        size_t n = samples.size();
+        stats.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+        stats.ci95 = TQuantile(n - 1) * stats.stddev / std::sqrt(static_cast<double>(n));
+        auto [min, max] = std::minmax_element(samples.begin(), samples.end());
+        stats.min = *min;
+        stats.max = *max;
+        return stats;
+    }
+
+private:
+    // Two-sided 97.5% quantile of Student's t distribution
+    static double TQuantile(size_t degrees) {
+        static const double kTable[] = {0,     12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                        2.201, 2.179,  2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                        2.080, 2.074,  2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+        if (degrees == 0) {
+            return 0;
+        }
+        return degrees < std::size(kTable) ? kTable[degrees] : 1.96;
+    }
+};
+
+struct BenchmarkResult {
+    std::string suite;
+    std::string name;
+    std::string variant;
+    size_t payload = 0;
+    size_t iterations = 0;
+    size_t samples = 0;
+    // Nanoseconds per operation
+    SampleStats ns;
+    // Hardware events per operation, averaged over all samples; empty without perf counters
+    std::vector<std::pair<std::string, double>> counters;
+};
+
+class Harness {
+public:
+    struct Options {
+        size_t samples = 15;
+        double min_sample_time_ns = 5e6;
+        // Only benchmarks whose "suite/name/variant" contains it are run
+        std::string filter;
+        bool perf_counters = true;
+    };
+
+    using Body = std::function<double(size_t iterations)>;
+
+    explicit Harness(Options options) : options_(std::move(options)) {
+        if (!options_.perf_counters) {
+            return;
+        }
+        counters_ = std::make_unique<PerfCounters>();
+        if (counters_->Empty()) {
+            std::fprintf(stderr, "perf counters unavailable, reporting timings only\n");
+            counters_.reset();
+        } else if (!counters_->Missing().empty()) {
+            std::string missing;
+            for (const auto& name : counters_->Missing()) {
+                missing += " " + name;
+            }
+            std::fprintf(stderr, "perf counters unavailable:%s\n", missing.c_str());
+        }
+    }
+
+    bool Selected(const std::string& suite, const std::string& name, const std::string& variant) const {
+        return (suite + "/" + name + "/" + variant).find(options_.filter) != std::string::npos;
+    }
+
+    void Run(const std::string& suite, const std::string& name, const std::string& variant, size_t payload,
+             const Body& body) {
+        if (!Selected(suite, name, variant)) {
+            return;
+        }
+        size_t iterations = Calibrate(body);
+        std::vector<std::pair<std::string, double>> before;
+        if (counters_) {
+            before = counters_->Read();
+            PerfCounters::Active() = counters_.get();
+        }
+        std::vector<double> samples;
+        for (size_t i = 0; i < options_.samples; ++i) {
+            samples.push_back(body(iterations) / iterations);
+        }
+        BenchmarkResult result{suite, name, variant, payload, iterations, samples.size(), SampleStats::Of(samples),
+                               /*counters=*/{}};
+        if (counters_) {
+            PerfCounters::Active() = nullptr;
+            for (const auto& [event, total] : counters_->Read()) {
+                auto start = std::find_if(before.begin(), before.end(), [&](const auto& value) {
+                    return value.first == event;
+                });
+                // An event that had not run yet is missing from `before`
+                double delta = total - (start != before.end() ? start->second : 0);
+                result.counters.emplace_back(event, delta / (iterations * samples.size()));
+            }
+        }
+        std::fprintf(stderr, "%-10s %-22s %-18s %6zu B %10.2f ns/op +- %.2f\n", suite.c_str(), name.c_str(),
+                     variant.c_str(), payload, result.ns.mean, result.ns.ci95);
+        if (!result.counters.empty()) {
+            std::string line;
+            char value[64];
+            for (const auto& [event, per_op] : result.counters) {
+                std::snprintf(value, sizeof(value), " %s %.2f", event.c_str(), per_op);
+                line += value;
+            }
+            std::fprintf(stderr, "%58s per op:%s\n", "", line.c_str());
+        }
+        results_.push_back(std::move(result));
+    }
+
+    const std::vector<BenchmarkResult>& Results() const {
+        return results_;
+    }
+
+    void WriteJson(std::ostream& out) const {
+        out << "{\n  \"context\": {\"compiler\": \"" << Escape(__VERSION__) << "\", \"samples\": " << options_.samples
+            << "},\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results_.size(); ++i) {
+            const auto& result = results_[i];
+            out << (i ? ",\n" : "\n") << "    {\"suite\": \"" << Escape(result.suite) << "\", \"name\": \""
+                << Escape(result.name) << "\", \"variant\": \"" << Escape(result.variant)
+                << "\", \"payload\": " << result.payload << ", \"iterations\": " << result.iterations
+                << ", \"samples\": " << result.samples << ", \"ns_per_op\": " << result.ns.mean
+                << ", \"ci95\": " << result.ns.ci95 << ", \"stddev\": " << result.ns.stddev
+                << ", \"min\": " << result.ns.min << ", \"max\": " << result.ns.max;
+            if (!result.counters.empty()) {
+                out << ", \"counters_per_op\": {";
+                for (size_t j = 0; j < result.counters.size(); ++j) {
+                    out << (j ? ", " : "") << "\"" << result.counters[j].first << "\": " << result.counters[j].second;
+                }
+                out << "}";
+            }
+            out << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+private:
+    // Grows the iteration count until one run takes long enough
+    size_t Calibrate(const Body& body) const {
+        size_t iterations = 1;
+        for (;;) {
+            double elapsed = body(iterations);
+            if (elapsed >= options_.min_sample_time_ns || iterations >= (size_t{1} << 30)) {
+                return iterations;
+            }
+            double scale = elapsed > 0 ? 1.4 * options_.min_sample_time_ns / elapsed : 10;
+            iterations = std::max(iterations + 1, static_cast<size_t>(iterations * std::min(scale, 10.0)));
+        }
+    }
+
+    static std::string Escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += static_cast<unsigned char>(c) < 0x20 ? ' ' : c;
+        }
+        return escaped;
+    }
+
+    Options options_;
+    std::unique_ptr<PerfCounters> counters_;
+    std::vector<BenchmarkResult> results_;
+};
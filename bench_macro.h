@@ -0,0 +1,1256 @@
+#pragma once
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "bench_harness.h"
+#include "bench_micro.h"
+#include "block_pool.h"
+#include "buffer.h"
+#include "concurrent_map.h"
+#include "interner.h"
+#include "seq_value.h"
+#include "serialize.h"
+#include "shared.h"
+#include "shared_cache.h"
+#include "shared_ptr_set.h"
+#include "snapshot.h"
+#include "synchronized.h"
+#include "task.h"
+#include "versioned.h"
+
+// Whole workloads instead of single operations, so allocator behaviour and memory locality show
+// up: a persistent balanced tree under path-copying updates, a DAG whose subtrees are shared
+// with a skewed (Zipf) popularity, SharedCache under Zipf keys, a producer/consumer pipeline
+// passing SharedPtr messages between threads, and teardown of a 10M-node tree. Next to them,
+// the containers built on SharedPtr run against the designs they replace: ConcurrentSharedMap
+// against mutex-guarded std::unordered_map shards, SharedPtrSet against
+// std::unordered_set<std::shared_ptr<T>>, and Interner against one MakeShared copy per record
+// on a duplicate-heavy dataset. Spawning 10M trivial SharedTask coroutines measures the pooled
+// frame allocation. Parse-and-forward reads length-prefixed frames from a file and forwards
+// each one to a pipe, as SharedBuffer slices gathered by BufferChain or as copies. Graph
+// round-trip writes a 10M-node tree with GraphWriter to a file and reads it back with
+// GraphReader; each direction is its own row. Warm start times how long the first query on that
+// tree takes when it is loaded with GraphReader, or mapped as a Snapshot and used in place; both
+// files were just written, so they come from the page cache. Read-mostly threads copy handles
+// to 64K records and read them under a shared lock, 1% of the operations write; the handles are
+// SharedSynchronized, which keeps object and lock in one allocation, or a SharedPtr<T> next to
+// a SharedPtr<std::shared_mutex>. The writer-rate sweep runs every thread against one 32 byte
+// record stored in a SharedSeqValue, a SharedSynchronized, or published as an immutable
+// SharedPtr<const T> that writers swap, with 0.1%, 1% and 10% of the operations writing. The
+// same mix at 1% and 10% writes compares VersionedShared, read with ReadLatest and written with
+// Commit, against that record under a single std::shared_mutex.
+// Every scenario is deterministic for a given seed and sized by Options (`scale` multiplies all
+// sizes). Each reports items per second, its peak RSS, the number of operator new calls it made
+// on any thread, and its peak heap growth: mallinfo2 in-use bytes (all malloc arenas, so pool
+// chunks included; blocks a pool kept from an earlier scenario are reused without growth)
+// sampled at the points where the scenario holds the most.
+
+// Counts operator new calls for the macro scenarios. The replacement below applies to the whole
+// bench binary, so counting has to stay cheap: threads are spread round-robin over padded
+// slots and each call is one relaxed increment of a line that is normally private to the thread.
+class AllocationCounter {
+public:
+    static constexpr size_t kSlots = 64;
+
+    static void Count() {
+        // Constant-initialized, so this is safe inside operator new during thread startup
+        static thread_local size_t index = kSlots;
+        if (index == kSlots) {
+            index = next_.fetch_add(1, std::memory_order_relaxed) % kSlots;
+        }
+        slots_[index].count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static uint64_t Total() {
+        uint64_t total = 0;
+        for (const auto& slot : slots_) {
+            total += slot.count.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> count{0};
+    };
+
+    static inline std::atomic<size_t> next_{0};
+    static Slot slots_[kSlots];
+};
+
+inline AllocationCounter::Slot AllocationCounter::slots_[AllocationCounter::kSlots];
+
+void* operator new(size_t size) {
+    AllocationCounter::Count();
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    AllocationCounter::Count();
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    AllocationCounter::Count();
+    size_t align = static_cast<size_t>(alignment);
+    if (void* p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+struct PooledSharedPtrTraits : OwnSharedPtrTraits {
+    static constexpr const char* kName = "SharedPtr/pooled";
+
+    template <typename T, typename... Args>
+    static Ptr<T> Make(Args&&... args) {
+        return MakeSharedPooled<T>(std::forward<Args>(args)...);
+    }
+};
+
+// The design ConcurrentSharedMap replaces: std::unordered_map shards behind one mutex each
+template <typename K, typename V>
+class ShardedMutexMap {
+public:
+    explicit ShardedMutexMap(size_t shard_count = 16)
+        : shard_count_(shard_count), shards_(new Shard[shard_count]) {
+    }
+
+    SharedPtr<V> Find(const K& key) const {
+        Shard& shard = ShardFor(key);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.map.find(key);
+        return it == shard.map.end() ? nullptr : it->second;
+    }
+
+    void InsertOrAssign(const K& key, SharedPtr<V> value) {
+        Shard& shard = ShardFor(key);
+        std::lock_guard lock(shard.mutex);
+        shard.map[key] = std::move(value);
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<K, SharedPtr<V>> map;
+    };
+
+    Shard& ShardFor(const K& key) const {
+        return shards_[std::hash<K>{}(key) % shard_count_];
+    }
+
+    size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+};
+
+// The pattern SharedSynchronized replaces: the object and its lock in two allocations
+template <typename T>
+class SeparateLockShared {
+public:
+    static SeparateLockShared Make() {
+        SeparateLockShared shared;
+        shared.value_ = MakeShared<T>();
+        shared.lock_ = MakeShared<std::shared_mutex>();
+        return shared;
+    }
+
+    template <typename F>
+    decltype(auto) WithRLock(F&& f) const {
+        std::shared_lock lock(*lock_);
+        return std::forward<F>(f)(std::as_const(*value_));
+    }
+
+    template <typename F>
+    decltype(auto) WithWLock(F&& f) const {
+        std::unique_lock lock(*lock_);
+        return std::forward<F>(f)(*value_);
+    }
+
+private:
+    SharedPtr<T> value_;
+    SharedPtr<std::shared_mutex> lock_;
+};
+
+// There is no atomic SharedPtr: readers copy the published pointer under a SpinRWLock, writers
+// swap in a new object and drop the old one after unlocking
+template <typename T>
+class SwappedShared {
+public:
+    explicit SwappedShared(SharedPtr<const T> value) : value_(std::move(value)) {
+    }
+
+    SharedPtr<const T> Load() const {
+        std::shared_lock lock(lock_);
+        return value_;
+    }
+
+    void Store(SharedPtr<const T> value) {
+        {
+            std::unique_lock lock(lock_);
+            value_.Swap(value);
+        }
+    }
+
+private:
+    mutable SpinRWLock lock_;
+    SharedPtr<const T> value_;
+};
+
+// Ranks 0..n-1 with P(k) proportional to 1 / (k + 1)^s, by inverting a precomputed CDF
+class ZipfDistribution {
+public:
+    ZipfDistribution(size_t n, double s) : cdf_(n) {
+        double sum = 0;
+        for (size_t k = 0; k < n; ++k) {
+            sum += 1 / std::pow(static_cast<double>(k + 1), s);
+            cdf_[k] = sum;
+        }
+        for (auto& value : cdf_) {
+            value /= sum;
+        }
+    }
+
+    template <typename Random>
+    size_t operator()(Random& random) const {
+        double u = static_cast<double>(random() >> 11) * 0x1.0p-53;
+        return std::min<size_t>(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin(), cdf_.size() - 1);
+    }
+
+private:
+    std::vector<double> cdf_;
+};
+
+class MacroBenchmarks {
+public:
+    struct Options {
+        uint64_t seed = 42;
+        double scale = 1;
+        // Balanced tree of 2^depth - 1 nodes, each update copies one root-to-leaf path
+        size_t tree_depth = 20;
+        size_t tree_updates = 200000;
+        // DAG nodes link to two earlier nodes picked with Zipf popularity, then random walks
+        // from the newest nodes copy pointers along their way
+        size_t dag_nodes = 1 << 20;
+        size_t dag_walks = 1 << 20;
+        double zipf_exponent = 0.99;
+        size_t cache_keys = 1 << 20;
+        size_t cache_capacity = 1 << 16;
+        size_t cache_ops = 1 << 21;
+        size_t pipeline_messages = 1 << 20;
+        size_t teardown_nodes = 10000000;
+        // 0: as many as there are CPUs, at least 2
+        size_t map_threads = 0;
+        size_t map_keys = 1 << 16;
+        size_t map_ops_per_thread = 1 << 20;
+        size_t set_objects = 1 << 20;
+        size_t set_lookups = 1 << 22;
+        // Records drawn with Zipf popularity from a vocabulary of distinct URL-like strings
+        size_t intern_vocabulary = 100000;
+        size_t intern_records = 1 << 22;
+        size_t tasks = 10000000;
+        size_t forward_bytes = 64 << 20;
+        size_t graph_nodes = 10000000;
+        // Records behind a lock, read by map_threads threads with 1% writes
+        size_t sync_objects = 1 << 16;
+        size_t sync_ops_per_thread = 1 << 20;
+        size_t writer_rate_ops_per_thread = 1 << 20;
+    };
+
+    struct Row {
+        std::string scenario;
+        std::string variant;
+        size_t items;
+        double seconds;
+        double items_per_second;
+        size_t peak_rss_bytes;
+        size_t peak_heap_bytes;
+        size_t allocations;
+    };
+
+    // Scenarios are selected by the harness filter on "macro/<scenario>/<variant>"
+    static std::vector<Row> Run(const Harness& harness, const Options& options) {
+        std::vector<Row> rows;
+        MacroBenchmarks benchmarks(harness, options, &rows);
+        benchmarks.RunVariant<OwnSharedPtrTraits>();
+        benchmarks.RunVariant<PooledSharedPtrTraits>();
+        benchmarks.RunVariant<StdSharedPtrTraits>();
+        benchmarks.RunCache();
+        benchmarks.RunConcurrentMap<ConcurrentSharedMap<uint64_t, uint64_t>>("ConcurrentSharedMap");
+        benchmarks.RunConcurrentMap<ShardedMutexMap<uint64_t, uint64_t>>("sharded mutex map");
+        benchmarks.RunReadMostly("SharedSynchronized", [] { return MakeSharedSynchronized<Record>(); });
+        benchmarks.RunReadMostly("SharedPtr + mutex", [] { return SeparateLockShared<Record>::Make(); });
+        benchmarks.RunWriterRate<SeqValueCell>("writer_rate", "SharedSeqValue", {1, 10, 100});
+        benchmarks.RunWriterRate<SynchronizedCell>("writer_rate", "SharedSynchronized", {1, 10, 100});
+        benchmarks.RunWriterRate<SwappedCell>("writer_rate", "SharedPtr swap", {1, 10, 100});
+        benchmarks.RunWriterRate<VersionedCell>("versioned", "VersionedShared", {10, 100});
+        benchmarks.RunWriterRate<SynchronizedCell>("versioned", "shared_mutex", {10, 100});
+        benchmarks.RunPointerSet<OwnSharedPtrTraits>("SharedPtrSet");
+        benchmarks.RunPointerSet<StdSharedPtrTraits>("std::unordered_set");
+        benchmarks.RunInterner(true);
+        benchmarks.RunInterner(false);
+        benchmarks.RunTaskSpawn();
+        benchmarks.RunParseAndForward(true);
+        benchmarks.RunParseAndForward(false);
+        benchmarks.RunGraphRoundTrip();
+        benchmarks.RunWarmStart();
+        return rows;
+    }
+
+    static void WriteCsv(const std::vector<Row>& rows, std::ostream& out) {
+        out << "scenario,variant,items,seconds,items_per_second,peak_rss_bytes,peak_heap_bytes,allocations\n";
+        for (const auto& row : rows) {
+            out << row.scenario << ',' << row.variant << ',' << row.items << ',' << row.seconds << ','
+                << row.items_per_second << ',' << row.peak_rss_bytes << ',' << row.peak_heap_bytes << ','
+                << row.allocations << '\n';
+        }
+    }
+
+    // Resident set high-water mark (VmHWM), 0 if unknown
+    static size_t PeakRssBytes() {
+        std::ifstream status("/proc/self/status");
+        for (std::string line; std::getline(status, line);) {
+            if (line.rfind("VmHWM:", 0) == 0) {
+                return std::stoull(line.substr(6)) * 1024;
+            }
+        }
+        return 0;
+    }
+
+    // Restarts VmHWM from the current RSS (Linux 4.0+); false if the kernel refused, in which
+    // case peaks cover the whole process so far
+    static bool ResetPeakRss() {
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        clear_refs << "5";
+        clear_refs.flush();
+        return static_cast<bool>(clear_refs);
+    }
+
+private:
+    template <typename Traits>
+    struct TreeNode {
+        typename Traits::template Ptr<TreeNode> left;
+        typename Traits::template Ptr<TreeNode> right;
+        uint64_t value = 0;
+    };
+
+    template <typename Traits>
+    struct DagNode {
+        typename Traits::template Ptr<DagNode> children[2];
+        uint64_t value = 0;
+    };
+
+    struct GraphNode {
+        SharedPtr<GraphNode> left;
+        SharedPtr<GraphNode> right;
+        uint64_t value = 0;
+
+        friend void Serialize(GraphWriter& writer, const GraphNode& node) {
+            writer.Write(node.value);
+            writer.Write(node.left);
+            writer.Write(node.right);
+        }
+        friend void Deserialize(GraphReader& reader, GraphNode& node) {
+            reader.Read(node.value);
+            reader.Read(node.left);
+            reader.Read(node.right);
+        }
+    };
+
+    struct SnapshotNode {
+        OffsetPtr<SnapshotNode> left;
+        OffsetPtr<SnapshotNode> right;
+        uint64_t value;
+    };
+
+    struct Message {
+        uint64_t sequence;
+        char payload[120];
+    };
+
+    struct Record {
+        uint64_t fields[4] = {};
+    };
+
+    // The writer-rate cells: Read sums a record, Write stores one filled with `value`
+    struct SeqValueCell {
+        uint64_t Read() const {
+            Record record = value.Load();
+            return record.fields[0] + record.fields[3];
+        }
+        void Write(uint64_t fill) {
+            value.Store(Record{{fill, fill, fill, fill}});
+        }
+
+        SharedSeqValue<Record> value = MakeSharedSeqValue<Record>();
+    };
+
+    struct SynchronizedCell {
+        uint64_t Read() const {
+            return value.WithRLock([](const Record& record) { return record.fields[0] + record.fields[3]; });
+        }
+        void Write(uint64_t fill) {
+            value.WithWLock([fill](Record& record) { record = Record{{fill, fill, fill, fill}}; });
+        }
+
+        SharedSynchronized<Record> value = MakeSharedSynchronized<Record>();
+    };
+
+    struct SwappedCell {
+        uint64_t Read() const {
+            SharedPtr<const Record> record = value.Load();
+            return record->fields[0] + record->fields[3];
+        }
+        void Write(uint64_t fill) {
+            value.Store(MakeShared<Record>(Record{{fill, fill, fill, fill}}));
+        }
+
+        SwappedShared<Record> value{MakeShared<Record>()};
+    };
+
+    struct VersionedCell {
+        uint64_t Read() const {
+            SharedPtr<const Record> record = value.ReadLatest();
+            return record->fields[0] + record->fields[3];
+        }
+        void Write(uint64_t fill) {
+            value.Commit(MakeShared<Record>(Record{{fill, fill, fill, fill}}));
+        }
+
+        VersionedShared<Record> value{MakeShared<Record>()};
+    };
+
+    MacroBenchmarks(const Harness& harness, const Options& options, std::vector<Row>* rows)
+        : harness_(harness), options_(options), rows_(rows) {
+    }
+
+    size_t Scaled(size_t size) const {
+        return std::max<size_t>(1, static_cast<size_t>(size * options_.scale));
+    }
+
+    // Calls `scenario()`, which returns the number of items it processed and the nanoseconds
+    // its measured part took
+    template <typename Scenario>
+    void Measure(const char* name, const char* variant, Scenario scenario) {
+        if (!harness_.Selected("macro", name, variant)) {
+            return;
+        }
+        // Memory the previous scenario freed would otherwise count as this one's
+        ::malloc_trim(0);
+        if (!ResetPeakRss() && !warned_) {
+            std::fprintf(stderr, "cannot reset peak RSS, peaks include earlier scenarios\n");
+            warned_ = true;
+        }
+        heap_base_ = HeapInUse();
+        heap_peak_ = 0;
+        uint64_t allocations = AllocationCounter::Total();
+        auto [items, ns] = scenario();
+        Checkpoint();
+        Row row{name, variant, items, ns / 1e9, items / ns * 1e9, PeakRssBytes(),
+                heap_peak_, AllocationCounter::Total() - allocations};
+        std::fprintf(stderr,
+                     "%-10s %-14s %-24s %10zu items %12.0f items/s %10zu allocs %8.1f MiB peak rss %8.1f MiB heap\n",
+                     "macro", name, variant, row.items, row.items_per_second, row.allocations,
+                     row.peak_rss_bytes / 1048576.0, row.peak_heap_bytes / 1048576.0);
+        rows_->push_back(std::move(row));
+    }
+
+    static size_t HeapInUse() {
+        struct mallinfo2 info = ::mallinfo2();
+        return info.uordblks + info.hblkhd;
+    }
+
+    // Samples heap growth since the scenario started; called by scenarios at their largest
+    // live state, from the thread running Measure
+    void Checkpoint() {
+        size_t in_use = HeapInUse();
+        heap_peak_ = std::max(heap_peak_, in_use > heap_base_ ? in_use - heap_base_ : 0);
+    }
+
+    template <typename Traits>
+    void RunVariant() {
+        const char* variant = Traits::kName;
+        Measure("tree", variant, [&] { return Tree<Traits>(); });
+        Measure("dag", variant, [&] { return Dag<Traits>(); });
+        Measure("pipeline", variant, [&] { return Pipeline<Traits>(); });
+        Measure("teardown", variant, [&] { return Teardown<Traits>(); });
+    }
+
+    // Balanced tree of `count` nodes, complete when count is 2^depth - 1
+    template <typename Traits>
+    static typename Traits::template Ptr<TreeNode<Traits>> BuildTree(size_t count) {
+        using Node = TreeNode<Traits>;
+        auto node = Traits::template Make<Node>();
+        node->value = count;
+        if (count > 1) {
+            size_t left = (count - 1) / 2;
+            if (left > 0) {
+                node->left = BuildTree<Traits>(left);
+            }
+            node->right = BuildTree<Traits>(count - 1 - left);
+        }
+        return node;
+    }
+
+    // Persistent updates: every version shares all but one path with the previous one, which
+    // dies as soon as the root is replaced
+    template <typename Traits>
+    std::pair<size_t, double> Tree() {
+        using Ptr = typename Traits::template Ptr<TreeNode<Traits>>;
+        std::mt19937_64 random(options_.seed);
+        auto scaled_depth = static_cast<long>(options_.tree_depth) + std::lround(std::log2(options_.scale));
+        auto depth = static_cast<size_t>(std::clamp(scaled_depth, 2L, 40L));
+        size_t updates = Scaled(options_.tree_updates);
+        Ptr root = BuildTree<Traits>((size_t{1} << depth) - 1);
+        Checkpoint();
+        std::vector<Ptr> path(depth);
+        Stopwatch watch;
+        for (size_t update = 0; update < updates; ++update) {
+            uint64_t leaf = random() & ((uint64_t{1} << (depth - 1)) - 1);
+            Ptr node = root;
+            for (size_t level = 0; level < depth; ++level) {
+                path[level] = Traits::template Make<TreeNode<Traits>>(*node);
+                if (level > 0) {
+                    auto& parent = path[level - 1];
+                    (leaf >> (depth - 1 - level) & 1 ? parent->right : parent->left) = path[level];
+                }
+                if (level + 1 < depth) {
+                    Ptr child = leaf >> (depth - 2 - level) & 1 ? node->right : node->left;
+                    node = std::move(child);
+                }
+            }
+            path[depth - 1]->value += 1;
+            root = std::move(path[0]);
+        }
+        double ns = watch.ElapsedNs();
+        return {updates, ns};
+    }
+
+    // Popular nodes end up shared by many parents; walks copy their pointers from many places
+    template <typename Traits>
+    std::pair<size_t, double> Dag() {
+        using Node = DagNode<Traits>;
+        using Ptr = typename Traits::template Ptr<Node>;
+        std::mt19937_64 random(options_.seed);
+        size_t count = Scaled(options_.dag_nodes);
+        size_t walks = Scaled(options_.dag_walks);
+        ZipfDistribution zipf(count, options_.zipf_exponent);
+        Stopwatch watch;
+        std::vector<Ptr> nodes;
+        nodes.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            auto node = Traits::template Make<Node>();
+            node->value = i;
+            if (i > 0) {
+                // Zipf rank 0 is the oldest node
+                node->children[0] = nodes[zipf(random) % i];
+                node->children[1] = nodes[zipf(random) % i];
+            }
+            nodes.push_back(std::move(node));
+        }
+        Checkpoint();
+        // Only the newest quarter stays referenced from outside
+        nodes.erase(nodes.begin(), nodes.begin() + count / 4 * 3);
+        uint64_t sum = 0;
+        for (size_t walk = 0; walk < walks; ++walk) {
+            Ptr node = nodes[random() % nodes.size()];
+            while (node) {
+                sum += node->value;
+                Ptr child = node->children[random() & 1];
+                node = std::move(child);
+            }
+        }
+        DoNotOptimize(sum);
+        nodes.clear();
+        double ns = watch.ElapsedNs();
+        return {count + walks, ns};
+    }
+
+    // Producer -> forwarder -> consumer over bounded queues; the forwarder also keeps the last
+    // few messages, so counts are shared between threads
+    template <typename Traits>
+    std::pair<size_t, double> Pipeline() {
+        using Ptr = typename Traits::template Ptr<Message>;
+        size_t messages = Scaled(options_.pipeline_messages);
+        BoundedQueue<Ptr> first(1024), second(1024);
+        Stopwatch watch;
+        std::thread producer([&] {
+            for (size_t i = 0; i < messages; ++i) {
+                auto message = Traits::template Make<Message>();
+                message->sequence = i;
+                first.Push(std::move(message));
+            }
+            first.Push(nullptr);
+        });
+        std::thread forwarder([&] {
+            std::vector<Ptr> recent(64);
+            for (size_t i = 0;; ++i) {
+                Ptr message = first.Pop();
+                if (!message) {
+                    break;
+                }
+                recent[i % recent.size()] = message;
+                second.Push(std::move(message));
+            }
+            second.Push(nullptr);
+        });
+        uint64_t expected = 0;
+        while (Ptr message = second.Pop()) {
+            if (message->sequence != expected++) {
+                std::fprintf(stderr, "pipeline out of order\n");
+            }
+            if (expected % 65536 == 0) {
+                Checkpoint();
+            }
+        }
+        producer.join();
+        forwarder.join();
+        double ns = watch.ElapsedNs();
+        return {messages, ns};
+    }
+
+    // Only the destruction of the whole tree is timed
+    template <typename Traits>
+    std::pair<size_t, double> Teardown() {
+        size_t count = Scaled(options_.teardown_nodes);
+        auto root = BuildTree<Traits>(count);
+        Checkpoint();
+        Stopwatch watch;
+        root = nullptr;
+        double ns = watch.ElapsedNs();
+        return {count, ns};
+    }
+
+    void RunCache() {
+        Measure("cache", "SharedCache", [&]() -> std::pair<size_t, double> {
+            std::mt19937_64 random(options_.seed);
+            size_t keys = Scaled(options_.cache_keys);
+            size_t ops = Scaled(options_.cache_ops);
+            ZipfDistribution zipf(keys, options_.zipf_exponent);
+            // Scatter the popular ranks over the key space
+            std::vector<uint64_t> permutation(keys);
+            for (size_t i = 0; i < keys; ++i) {
+                permutation[i] = i;
+            }
+            std::shuffle(permutation.begin(), permutation.end(), random);
+            SharedCache<uint64_t, Message> cache(Scaled(options_.cache_capacity));
+            Stopwatch watch;
+            for (size_t op = 0; op < ops; ++op) {
+                uint64_t key = permutation[zipf(random)];
+                auto value = cache.GetOrCreate(key, [&] {
+                    auto message = MakeShared<Message>();
+                    message->sequence = key;
+                    return message;
+                });
+                DoNotOptimize(value);
+            }
+            double ns = watch.ElapsedNs();
+            Checkpoint();
+            auto stats = cache.GetStats();
+            std::fprintf(stderr, "macro      cache hit ratio %.3f, %zu evictions\n",
+                         static_cast<double>(stats.hits) / std::max<size_t>(1, stats.hits + stats.misses),
+                         stats.evictions);
+            return {ops, ns};
+        });
+    }
+
+    // Every thread mixes lookups of random keys with InsertOrAssign of fresh values, at 90/10
+    // and 50/50 read/write ratios
+    template <typename Map>
+    void RunConcurrentMap(const char* map_name) {
+        for (unsigned reads : {90u, 50u}) {
+            std::string variant =
+                std::string(map_name) + " " + std::to_string(reads) + "/" + std::to_string(100 - reads);
+            Measure("concurrent_map", variant.c_str(), [&]() -> std::pair<size_t, double> {
+                size_t threads = options_.map_threads
+                                     ? options_.map_threads
+                                     : std::max<size_t>(2, std::thread::hardware_concurrency());
+                size_t keys = Scaled(options_.map_keys);
+                size_t ops = Scaled(options_.map_ops_per_thread);
+                Map map;
+                for (uint64_t key = 0; key < keys; ++key) {
+                    map.InsertOrAssign(key, MakeShared<uint64_t>(key));
+                }
+                std::atomic<bool> go{false};
+                std::vector<std::thread> workers;
+                for (size_t i = 0; i < threads; ++i) {
+                    workers.emplace_back([&, i] {
+                        std::mt19937_64 random(options_.seed + i);
+                        while (!go.load(std::memory_order_acquire)) {
+                            std::this_thread::yield();
+                        }
+                        uint64_t sum = 0;
+                        for (size_t op = 0; op < ops; ++op) {
+                            uint64_t value = random();
+                            uint64_t key = value % keys;
+                            if ((value >> 32 & 0xffff) % 100 < reads) {
+                                if (auto found = map.Find(key)) {
+                                    sum += *found;
+                                }
+                            } else {
+                                map.InsertOrAssign(key, MakeShared<uint64_t>(value));
+                            }
+                        }
+                        DoNotOptimize(sum);
+                    });
+                }
+                Stopwatch watch;
+                go.store(true, std::memory_order_release);
+                for (auto& worker : workers) {
+                    worker.join();
+                }
+                double ns = watch.ElapsedNs();
+                Checkpoint();
+                return {threads * ops, ns};
+            });
+        }
+    }
+
+    // Threads for the multi-threaded scenarios: map_threads, or as many as there are CPUs, at
+    // least 2
+    size_t Workers() const {
+        return options_.map_threads ? options_.map_threads : std::max<size_t>(2, std::thread::hardware_concurrency());
+    }
+
+    // Starts `threads` threads running `work(index)` together, returns the wall time until the
+    // last one finished
+    template <typename Work>
+    static double RunWorkers(size_t threads, Work work) {
+        std::atomic<bool> go{false};
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back([&, i] {
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                work(i);
+            });
+        }
+        Stopwatch watch;
+        go.store(true, std::memory_order_release);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        return watch.ElapsedNs();
+    }
+
+    // Every operation copies the handle of a random record, then sums it under the shared lock
+    // or, one time in a hundred, bumps its fields under the exclusive lock
+    template <typename Make>
+    void RunReadMostly(const char* variant, Make make) {
+        Measure("read_mostly", variant, [&]() -> std::pair<size_t, double> {
+            using Handle = decltype(make());
+            size_t threads = Workers();
+            size_t ops = Scaled(options_.sync_ops_per_thread);
+            std::vector<Handle> records;
+            for (size_t i = 0, count = Scaled(options_.sync_objects); i < count; ++i) {
+                records.push_back(make());
+            }
+            Checkpoint();
+            double ns = RunWorkers(threads, [&](size_t index) {
+                std::mt19937_64 random(options_.seed + index);
+                uint64_t sum = 0;
+                for (size_t op = 0; op < ops; ++op) {
+                    uint64_t value = random();
+                    Handle handle = records[value % records.size()];
+                    if ((value >> 32) % 100 == 0) {
+                        handle.WithWLock([](Record& record) {
+                            for (auto& field : record.fields) {
+                                ++field;
+                            }
+                        });
+                    } else {
+                        sum += handle.WithRLock([](const Record& record) {
+                            return record.fields[0] + record.fields[3];
+                        });
+                    }
+                }
+                DoNotOptimize(sum);
+            });
+            return {threads * ops, ns};
+        });
+    }
+
+    // All threads share one cell; a write is drawn with probability `per_mille` / 1000
+    template <typename Cell>
+    void RunWriterRate(const char* scenario, const char* cell_name, std::initializer_list<unsigned> write_rates) {
+        for (unsigned per_mille : write_rates) {
+            std::string variant = std::string(cell_name) + " " + std::to_string(per_mille / 10) + "." +
+                                  std::to_string(per_mille % 10) + "%";
+            Measure(scenario, variant.c_str(), [&]() -> std::pair<size_t, double> {
+                size_t threads = Workers();
+                size_t ops = Scaled(options_.writer_rate_ops_per_thread);
+                Cell cell;
+                double ns = RunWorkers(threads, [&](size_t index) {
+                    std::mt19937_64 random(options_.seed + index);
+                    uint64_t sum = 0;
+                    for (size_t op = 0; op < ops; ++op) {
+                        uint64_t value = random();
+                        if (value % 1000 < per_mille) {
+                            cell.Write(value);
+                        } else {
+                            sum += cell.Read();
+                        }
+                    }
+                    DoNotOptimize(sum);
+                });
+                return {threads * ops, ns};
+            });
+        }
+    }
+
+    // Inserts set_objects pointers, then looks up random ones, half of them absent
+    template <typename Traits>
+    void RunPointerSet(const char* variant) {
+        Measure("pointer_set", variant, [&]() -> std::pair<size_t, double> {
+            using Ptr = typename Traits::template Ptr<uint64_t>;
+            using Set = std::conditional_t<std::is_same_v<Traits, OwnSharedPtrTraits>, SharedPtrSet<uint64_t>,
+                                           std::unordered_set<Ptr>>;
+            std::mt19937_64 random(options_.seed);
+            size_t objects = Scaled(options_.set_objects);
+            size_t lookups = Scaled(options_.set_lookups);
+            std::vector<Ptr> members, strangers;
+            for (size_t i = 0; i < objects; ++i) {
+                members.push_back(Traits::template Make<uint64_t>(i));
+                strangers.push_back(Traits::template Make<uint64_t>(i));
+            }
+            // Only the set itself counts as heap growth
+            heap_base_ = HeapInUse();
+            Stopwatch watch;
+            Set set;
+            for (const auto& member : members) {
+                if constexpr (std::is_same_v<Traits, OwnSharedPtrTraits>) {
+                    set.Insert(member);
+                } else {
+                    set.insert(member);
+                }
+            }
+            size_t found = 0;
+            for (size_t i = 0; i < lookups; ++i) {
+                uint64_t value = random();
+                const Ptr& key = (value & 1 ? members : strangers)[(value >> 1) % objects];
+                if constexpr (std::is_same_v<Traits, OwnSharedPtrTraits>) {
+                    found += set.Contains(key);
+                } else {
+                    found += set.count(key);
+                }
+            }
+            DoNotOptimize(found);
+            double ns = watch.ElapsedNs();
+            Checkpoint();
+            return {objects + lookups, ns};
+        });
+    }
+
+    // Keeps every record alive, so the heap growth is what holding the dataset costs
+    void RunInterner(bool interned) {
+        Measure("interner", interned ? "Interner" : "MakeShared per record", [&]() -> std::pair<size_t, double> {
+            std::mt19937_64 random(options_.seed);
+            size_t vocabulary = Scaled(options_.intern_vocabulary);
+            size_t records = Scaled(options_.intern_records);
+            std::vector<std::string> words;
+            for (size_t i = 0; i < vocabulary; ++i) {
+                words.push_back("https://shop.example.com/catalog/item/" + std::to_string(random() % 1000000000) +
+                                "?ref=campaign-" + std::to_string(i));
+            }
+            ZipfDistribution zipf(vocabulary, options_.zipf_exponent);
+            std::vector<uint32_t> picks(records);
+            for (auto& pick : picks) {
+                pick = static_cast<uint32_t>(zipf(random));
+            }
+            std::vector<SharedPtr<const std::string>> held;
+            held.reserve(records);
+            heap_base_ = HeapInUse();
+            Interner<std::string> interner;
+            Stopwatch watch;
+            for (uint32_t pick : picks) {
+                held.push_back(interned ? interner.Intern(words[pick]) : MakeShared<const std::string>(words[pick]));
+            }
+            double ns = watch.ElapsedNs();
+            Checkpoint();
+            if (interned) {
+                std::fprintf(stderr, "macro      interner %zu distinct values for %zu records\n", interner.Size(),
+                             records);
+            }
+            return {records, ns};
+        });
+    }
+
+    static SharedTask<uint64_t> TrivialTask(uint64_t value) {
+        co_return value;
+    }
+
+    // Each task is created, runs to completion eagerly, is read and dropped
+    void RunTaskSpawn() {
+        Measure("task_spawn", "SharedTask", [&]() -> std::pair<size_t, double> {
+            size_t tasks = Scaled(options_.tasks);
+            uint64_t sum = 0;
+            Stopwatch watch;
+            for (size_t i = 0; i < tasks; ++i) {
+                sum += TrivialTask(i).Get();
+            }
+            double ns = watch.ElapsedNs();
+            DoNotOptimize(sum);
+            return {tasks, ns};
+        });
+    }
+
+    static constexpr size_t kReadChunk = 64 * 1024;
+    static constexpr size_t kMaxFrame = 2048;
+
+    static bool WriteAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t count = ::write(fd, data, size);
+            if (count < 0 && errno != EINTR) {
+                return false;
+            }
+            data += count > 0 ? count : 0;
+            size -= count > 0 ? static_cast<size_t>(count) : 0;
+        }
+        return true;
+    }
+
+    // Unlinked temporary file of frames: a 4-byte native length, then that many bytes
+    int WriteFrames(size_t bytes, size_t* frames) {
+        char path[] = "/tmp/my_shared_ptr_bench.XXXXXX";
+        int fd = ::mkstemp(path);
+        if (fd < 0) {
+            return -1;
+        }
+        ::unlink(path);
+        std::mt19937_64 random(options_.seed);
+        std::string data;
+        *frames = 0;
+        while (data.size() < bytes) {
+            auto length = static_cast<uint32_t>(16 + random() % (kMaxFrame - 16));
+            data.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            data.append(length, static_cast<char>('a' + *frames % 26));
+            ++*frames;
+        }
+        if (!WriteAll(fd, data.data(), data.size()) || ::lseek(fd, 0, SEEK_SET) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Frames forwarded as slices of the read buffers; only a frame cut by a read boundary is
+    // copied, into the next read buffer
+    static void ForwardSlices(int in, int out) {
+        SharedBuffer carry;
+        BufferChain chain;
+        for (;;) {
+            auto buffer = SharedBuffer::Allocate(carry.Size() + kReadChunk);
+            if (!carry.Empty()) {
+                std::memcpy(buffer.Data(), carry.Data(), carry.Size());
+            }
+            ssize_t count = ::read(in, buffer.Data() + carry.Size(), kReadChunk);
+            if (count <= 0) {
+                break;
+            }
+            auto data = buffer.Slice(0, carry.Size() + static_cast<size_t>(count));
+            size_t position = 0;
+            uint32_t length;
+            while (data.Size() - position >= sizeof(length)) {
+                std::memcpy(&length, data.Data() + position, sizeof(length));
+                if (data.Size() - position - sizeof(length) < length) {
+                    break;
+                }
+                chain.Append(data.Slice(position, sizeof(length) + length));
+                position += sizeof(length) + length;
+            }
+            carry = data.Slice(position);
+            if (chain.Size() >= kReadChunk) {
+                chain.WriteAllTo(out);
+            }
+        }
+        chain.WriteAllTo(out);
+    }
+
+    // The copying design: every frame becomes its own string and is appended to an output buffer
+    static void ForwardCopies(int in, int out) {
+        std::vector<char> buffer(kReadChunk + sizeof(uint32_t) + kMaxFrame);
+        size_t filled = 0;
+        std::string pending;
+        for (;;) {
+            ssize_t count = ::read(in, buffer.data() + filled, kReadChunk);
+            if (count <= 0) {
+                break;
+            }
+            filled += static_cast<size_t>(count);
+            size_t position = 0;
+            uint32_t length;
+            while (filled - position >= sizeof(length)) {
+                std::memcpy(&length, buffer.data() + position, sizeof(length));
+                if (filled - position - sizeof(length) < length) {
+                    break;
+                }
+                std::string frame(buffer.data() + position, sizeof(length) + length);
+                pending += frame;
+                position += sizeof(length) + length;
+            }
+            std::memmove(buffer.data(), buffer.data() + position, filled - position);
+            filled -= position;
+            if (pending.size() >= kReadChunk) {
+                WriteAll(out, pending.data(), pending.size());
+                pending.clear();
+            }
+        }
+        WriteAll(out, pending.data(), pending.size());
+    }
+
+    void RunParseAndForward(bool slices) {
+        Measure("forward", slices ? "SharedBuffer slices" : "copies", [&]() -> std::pair<size_t, double> {
+            size_t frames = 0;
+            size_t bytes = Scaled(options_.forward_bytes);
+            int in = WriteFrames(bytes, &frames);
+            int pipe_fds[2];
+            if (in < 0 || ::pipe(pipe_fds) != 0) {
+                std::perror("forward");
+                return {0, 1};
+            }
+            size_t forwarded = 0;
+            std::thread drain([&] {
+                std::vector<char> sink(kReadChunk);
+                ssize_t count;
+                while ((count = ::read(pipe_fds[0], sink.data(), sink.size())) > 0) {
+                    forwarded += static_cast<size_t>(count);
+                }
+            });
+            Stopwatch watch;
+            if (slices) {
+                ForwardSlices(in, pipe_fds[1]);
+            } else {
+                ForwardCopies(in, pipe_fds[1]);
+            }
+            ::close(pipe_fds[1]);
+            drain.join();
+            double ns = watch.ElapsedNs();
+            ::close(pipe_fds[0]);
+            off_t size = ::lseek(in, 0, SEEK_END);
+            ::close(in);
+            if (static_cast<off_t>(forwarded) != size) {
+                std::fprintf(stderr, "forward: %zu of %lld bytes arrived\n", forwarded, static_cast<long long>(size));
+            }
+            return {frames, ns};
+        });
+    }
+
+    // Implicit binary heap layout: node i has children 2i+1 and 2i+2
+    static SharedPtr<GraphNode> BuildGraph(size_t count) {
+        std::vector<SharedPtr<GraphNode>> nodes(count);
+        for (size_t i = count; i-- > 0;) {
+            nodes[i] = MakeShared<GraphNode>();
+            nodes[i]->value = i;
+            if (2 * i + 1 < count) {
+                nodes[i]->left = std::move(nodes[2 * i + 1]);
+            }
+            if (2 * i + 2 < count) {
+                nodes[i]->right = std::move(nodes[2 * i + 2]);
+            }
+        }
+        return std::move(nodes[0]);
+    }
+
+    // Building the tree, and dropping it and the reader's id table, are not timed
+    void RunGraphRoundTrip() {
+        size_t count = Scaled(options_.graph_nodes);
+        char path[] = "/tmp/my_shared_ptr_bench.XXXXXX";
+        int fd = ::mkstemp(path);
+        if (fd < 0) {
+            std::perror("graph");
+            return;
+        }
+        ::unlink(path);
+        Measure("graph", "GraphWriter", [&]() -> std::pair<size_t, double> {
+            auto root = BuildGraph(count);
+            Checkpoint();
+            GraphWriter writer(fd);
+            Stopwatch watch;
+            bool ok = writer.WriteGraph(root);
+            double ns = watch.ElapsedNs();
+            Checkpoint();
+            if (!ok) {
+                std::perror("graph: write");
+            }
+            return {count, ns};
+        });
+        if (::lseek(fd, 0, SEEK_SET) == 0) {
+            Measure("graph", "GraphReader", [&]() -> std::pair<size_t, double> {
+                SharedPtr<GraphNode> root;
+                GraphReader reader(fd);
+                Stopwatch watch;
+                bool ok = reader.ReadGraph(&root);
+                double ns = watch.ElapsedNs();
+                Checkpoint();
+                if (!ok || root->value != 0) {
+                    std::fprintf(stderr, "graph: read failed\n");
+                }
+                return {count, ns};
+            });
+        }
+        ::close(fd);
+    }
+
+    // The BuildGraph tree laid out for Snapshot, root first
+    static bool WriteSnapshot(size_t count, const std::string& path) {
+        SnapshotBuilder builder;
+        std::vector<size_t> offsets(count);
+        for (size_t i = 0; i < count; ++i) {
+            offsets[i] = builder.Emplace<SnapshotNode>(SnapshotNode{nullptr, nullptr, i});
+        }
+        for (size_t i = 0; 2 * i + 1 < count; ++i) {
+            auto node = builder.At<SnapshotNode>(offsets[i]);
+            node->left = builder.At<SnapshotNode>(offsets[2 * i + 1]);
+            if (2 * i + 2 < count) {
+                node->right = builder.At<SnapshotNode>(offsets[2 * i + 2]);
+            }
+        }
+        builder.AddRoot(offsets[0]);
+        return builder.WriteTo(path);
+    }
+
+    static bool WriteGraphFile(size_t count, const std::string& path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = GraphWriter(fd).WriteGraph(BuildGraph(count));
+        return ::close(fd) == 0 && ok;
+    }
+
+    // Timed from opening the file until the root's left child has been read. Each Snapshot run
+    // leaves its mapping behind, as every Snapshot does.
+    void RunWarmStart() {
+        if (!harness_.Selected("macro", "warm start", "Snapshot") &&
+            !harness_.Selected("macro", "warm start", "GraphReader")) {
+            return;
+        }
+        size_t count = std::max<size_t>(2, Scaled(options_.graph_nodes));
+        char directory[] = "/tmp/my_shared_ptr_bench.XXXXXX";
+        if (!::mkdtemp(directory)) {
+            std::perror("warm start");
+            return;
+        }
+        std::string snapshot_path = std::string(directory) + "/graph.snap";
+        std::string graph_path = std::string(directory) + "/graph.bin";
+        if (WriteSnapshot(count, snapshot_path) && WriteGraphFile(count, graph_path)) {
+            Measure("warm start", "Snapshot", [&]() -> std::pair<size_t, double> {
+                Stopwatch watch;
+                auto snapshot = Snapshot::Open(snapshot_path);
+                auto root = snapshot.Root<SnapshotNode>(0);
+                uint64_t value = root ? root->left->value : 0;
+                double ns = watch.ElapsedNs();
+                ReportFirstQuery(value, ns);
+                return {count, ns};
+            });
+            Measure("warm start", "GraphReader", [&]() -> std::pair<size_t, double> {
+                Stopwatch watch;
+                int fd = ::open(graph_path.c_str(), O_RDONLY | O_CLOEXEC);
+                SharedPtr<GraphNode> root;
+                bool ok = fd >= 0 && GraphReader(fd).ReadGraph(&root);
+                uint64_t value = ok ? root->left->value : 0;
+                double ns = watch.ElapsedNs();
+                Checkpoint();
+                ::close(fd);
+                ReportFirstQuery(value, ns);
+                return {count, ns};
+            });
+        } else {
+            std::perror("warm start");
+        }
+        ::unlink(snapshot_path.c_str());
+        ::unlink(graph_path.c_str());
+        ::rmdir(directory);
+    }
+
+    static void ReportFirstQuery(uint64_t value, double ns) {
+        if (value != 1) {
+            std::fprintf(stderr, "warm start: query failed\n");
+        }
+        std::fprintf(stderr, "macro      first query after %.3f ms\n", ns / 1e6);
+    }
+
+    template <typename T>
+    class BoundedQueue {
+    public:
+        explicit BoundedQueue(size_t capacity) : capacity_(capacity) {
+        }
+
+        void Push(T value) {
+            std::unique_lock lock(mutex_);
+            not_full_.wait(lock, [&] { return items_.size() < capacity_; });
+            items_.push_back(std::move(value));
+            not_empty_.notify_one();
+        }
+
+        T Pop() {
+            std::unique_lock lock(mutex_);
+            not_empty_.wait(lock, [&] { return !items_.empty(); });
+            T value = std::move(items_.front());
+            items_.pop_front();
+            not_full_.notify_one();
+            return value;
+        }
+
+    private:
+        size_t capacity_;
+        std::mutex mutex_;
+        std::condition_variable not_full_;
+        std::condition_variable not_empty_;
+        std::deque<T> items_;
+    };
+
+    const Harness& harness_;
+    const Options& options_;
+    std::vector<Row>* rows_;
+    bool warned_ = false;
+    size_t heap_base_ = 0;
+    size_t heap_peak_ = 0;
+};
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench_harness.h"
+#include "block_pool.h"
+#include "future.h"
+#include "shared.h"
+#include "shared_function.h"
+
+// Single-threaded cost of every SharedPtr operation next to std::shared_ptr.
+// Allocation-bound operations run for several payload sizes, reference count operations on the
+// smallest one. Construction and destruction are timed separately by building batches of
+// pointers and tearing them down outside the measured part. Pooled blocks are also walked in
+// random order with and without BlockPool huge pages, for the dTLB miss counts.
+// The types built on SharedPtr run against their standard counterparts: a SharedPromise /
+// SharedFuture ping-pong between two threads against std::promise / std::future, and copying
+// and invoking a SharedFunction against std::function, with a capture that fits the
+// small-buffer optimization of std::function and one that does not.
+
+template <size_t N>
+struct Payload {
+    char bytes[N];
+};
+
+struct OwnSharedPtrTraits {
+    static constexpr const char* kName = "SharedPtr";
+
+    template <typename T>
+    using Ptr = SharedPtr<T>;
+
+    template <typename T, typename... Args>
+    static Ptr<T> Make(Args&&... args) {
+        return MakeShared<T>(std::forward<Args>(args)...);
+    }
+    template <typename T>
+    static void Reset(Ptr<T>& ptr, T* raw) {
+        ptr.Reset(raw);
+    }
+    template <typename T>
+    static void Swap(Ptr<T>& left, Ptr<T>& right) {
+        left.Swap(right);
+    }
+};
+
+struct StdSharedPtrTraits {
+    static constexpr const char* kName = "std::shared_ptr";
+
+    template <typename T>
+    using Ptr = std::shared_ptr<T>;
+
+    template <typename T, typename... Args>
+    static Ptr<T> Make(Args&&... args) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+    template <typename T>
+    static void Reset(Ptr<T>& ptr, T* raw) {
+        ptr.reset(raw);
+    }
+    template <typename T>
+    static void Swap(Ptr<T>& left, Ptr<T>& right) {
+        left.swap(right);
+    }
+};
+
+struct SharedFutureTraits {
+    static constexpr const char* kName = "SharedPromise";
+
+    using Promise = SharedPromise<uint64_t>;
+    using Future = SharedFuture<uint64_t>;
+
+    static Future GetFuture(Promise& promise) {
+        return promise.GetFuture();
+    }
+    static void Set(Promise& promise, uint64_t value) {
+        promise.SetValue(value);
+    }
+    static uint64_t Get(Future& future) {
+        return future.Get();
+    }
+};
+
+struct StdFutureTraits {
+    static constexpr const char* kName = "std::promise";
+
+    using Promise = std::promise<uint64_t>;
+    using Future = std::future<uint64_t>;
+
+    static Future GetFuture(Promise& promise) {
+        return promise.get_future();
+    }
+    static void Set(Promise& promise, uint64_t value) {
+        promise.set_value(value);
+    }
+    static uint64_t Get(Future& future) {
+        return future.get();
+    }
+};
+
+struct SharedFunctionTraits {
+    static constexpr const char* kName = "SharedFunction";
+
+    using Function = SharedFunction<uint64_t(uint64_t)>;
+
+    template <typename F>
+    static Function Make(F&& f) {
+        return MakeSharedFunction<uint64_t(uint64_t)>(std::forward<F>(f));
+    }
+};
+
+struct StdFunctionTraits {
+    static constexpr const char* kName = "std::function";
+
+    using Function = std::function<uint64_t(uint64_t)>;
+
+    template <typename F>
+    static Function Make(F&& f) {
+        return Function(std::forward<F>(f));
+    }
+};
+
+class MicroBenchmarks {
+public:
+    static constexpr size_t kBatch = 1024;
+
+    static void Run(Harness& harness) {
+        RunImpl<OwnSharedPtrTraits>(harness);
+        RunImpl<StdSharedPtrTraits>(harness);
+        RunPooledRandomAccess(harness);
+        RunPingPong<SharedFutureTraits>(harness);
+        RunPingPong<StdFutureTraits>(harness);
+        RunFunction<SharedFunctionTraits>(harness);
+        RunFunction<StdFunctionTraits>(harness);
+    }
+
+private:
+    static constexpr size_t kChaseNodes = size_t{1} << 20;
+
+    struct ChaseNode {
+        const ChaseNode* next;
+        char payload[48];
+    };
+
+    // One random cycle through kChaseNodes MakeSharedPooled blocks. The blocks are leaked on
+    // purpose: keeping them allocated makes the next variant start on fresh chunks.
+    static const ChaseNode* BuildChain() {
+        auto nodes = new std::vector<SharedPtr<ChaseNode>>(kChaseNodes);
+        for (auto& node : *nodes) {
+            node = MakeSharedPooled<ChaseNode>();
+        }
+        std::vector<size_t> order(kChaseNodes);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+        for (size_t i = 0; i < kChaseNodes; ++i) {
+            (*nodes)[order[i]]->next = (*nodes)[order[(i + 1) % kChaseNodes]].Get();
+        }
+        return (*nodes)[0].Get();
+    }
+
+    // Dependent loads over 1M pooled blocks (about 80 MiB), on 4 KiB pages and in
+    // EnableHugePages regions; compare the dtlb_misses column where perf counters work
+    static void RunPooledRandomAccess(Harness& harness) {
+        for (bool huge : {false, true}) {
+            const char* variant = huge ? "huge pages" : "4k pages";
+            if (!harness.Selected("micro", "pooled_random_access", variant)) {
+                continue;
+            }
+            if (huge) {
+                BlockPool::EnableHugePages();
+            }
+            const ChaseNode* start = BuildChain();
+            if (huge) {
+                BlockPool::DisableHugePages();
+                auto stats = BlockPool::GetStats();
+                std::fprintf(stderr, "pooled_random_access: %zu of %zu regions advised as huge pages\n",
+                             stats.huge_regions, stats.regions);
+            }
+            harness.Run("micro", "pooled_random_access", variant, sizeof(ChaseNode), [start](size_t iterations) {
+                const ChaseNode* node = start;
+                Stopwatch watch;
+                for (size_t i = 0; i < iterations; ++i) {
+                    node = node->next;
+                }
+                double ns = watch.ElapsedNs();
+                DoNotOptimize(node);
+                return ns;
+            });
+        }
+    }
+
+    // One iteration is a round trip: the main thread sets the ping promise of the round and
+    // waits for the pong the worker sets in reply. Both pairs of a round are created by the main
+    // thread during the previous round, so their allocation is timed as well; setting the ping
+    // publishes them to the worker.
+    template <typename Traits>
+    static void RunPingPong(Harness& harness) {
+        harness.Run("micro", "future_ping_pong", Traits::kName, sizeof(uint64_t), [](size_t iterations) {
+            struct Round {
+                Round() : ping_future(Traits::GetFuture(ping)), pong_future(Traits::GetFuture(pong)) {
+                }
+
+                typename Traits::Promise ping, pong;
+                typename Traits::Future ping_future, pong_future;
+            };
+            double total = 0;
+            for (size_t done = 0; done < iterations;) {
+                size_t count = std::min(kBatch, iterations - done);
+                std::vector<std::optional<Round>> rounds(count);
+                rounds[0].emplace();
+                std::thread worker([&rounds, count] {
+                    for (size_t i = 0; i < count; ++i) {
+                        Round& round = *rounds[i];
+                        Traits::Set(round.pong, Traits::Get(round.ping_future) + 1);
+                    }
+                });
+                Stopwatch watch;
+                uint64_t sum = 0;
+                for (size_t i = 0; i < count; ++i) {
+                    if (i + 1 < count) {
+                        rounds[i + 1].emplace();
+                    }
+                    Traits::Set(rounds[i]->ping, i);
+                    sum += Traits::Get(rounds[i]->pong_future);
+                }
+                total += watch.ElapsedNs();
+                DoNotOptimize(sum);
+                worker.join();
+                done += count;
+            }
+            return total;
+        });
+    }
+
+    // Copies and calls of a function capturing 8 bytes, which std::function keeps inline, and
+    // 256 bytes, which it copies to the heap on every copy
+    template <typename Traits>
+    static void RunFunction(Harness& harness) {
+        using Function = typename Traits::Function;
+        uint64_t small = 3;
+        std::array<uint64_t, 32> large{};
+        large[0] = 3;
+        std::pair<size_t, Function> functions[] = {
+            {sizeof(small), Traits::Make([small](uint64_t x) { return x * small; })},
+            {sizeof(large), Traits::Make([large](uint64_t x) { return x * large[0]; })},
+        };
+        for (auto& [capture, function] : functions) {
+            harness.Run("micro", "function_copy", Traits::kName, capture, [&function](size_t iterations) {
+                return Batched<Function>(
+                    iterations, [&](Function& slot) { slot = function; }, [](Function& slot) { slot = nullptr; });
+            });
+            harness.Run("micro", "function_invoke", Traits::kName, capture, [&function](size_t iterations) {
+                uint64_t sum = 0;
+                Stopwatch watch;
+                for (size_t i = 0; i < iterations; ++i) {
+                    sum += function(i);
+                    DoNotOptimize(sum);
+                }
+                return watch.ElapsedNs();
+            });
+        }
+    }
+
+    template <typename Traits>
+    static void RunImpl(Harness& harness) {
+        RunPayload<Traits, 8>(harness, true);
+        RunPayload<Traits, 64>(harness, false);
+        RunPayload<Traits, 512>(harness, false);
+        RunPayload<Traits, 4096>(harness, false);
+    }
+
+    // Times `op(slot)` over batches of slots, calling `untimed(slot)` on each batch afterwards
+    template <typename Slot, typename Op, typename Untimed>
+    static double Batched(size_t iterations, Op op, Untimed untimed) {
+        std::vector<Slot> slots(std::min(iterations, kBatch));
+        double total = 0;
+        for (size_t done = 0; done < iterations;) {
+            size_t count = std::min(kBatch, iterations - done);
+            Stopwatch watch;
+            for (size_t i = 0; i < count; ++i) {
+                op(slots[i]);
+            }
+            total += watch.ElapsedNs();
+            for (size_t i = 0; i < count; ++i) {
+                untimed(slots[i]);
+            }
+            done += count;
+        }
+        return total;
+    }
+
+    template <typename Traits, size_t N>
+    static void RunPayload(Harness& harness, bool refcount_ops) {
+        using P = Payload<N>;
+        using Ptr = typename Traits::template Ptr<P>;
+        const std::string variant = Traits::kName;
+        auto run = [&](const char* name, Harness::Body body) {
+            harness.Run("micro", name, variant, N, body);
+        };
+
+        run("construct_new", [](size_t iterations) {
+            return Batched<Ptr>(iterations, [](Ptr& slot) { slot = Ptr(new P); }, [](Ptr& slot) { slot = nullptr; });
+        });
+        run("make_shared", [](size_t iterations) {
+            return Batched<Ptr>(
+                iterations, [](Ptr& slot) { slot = Traits::template Make<P>(); }, [](Ptr& slot) { slot = nullptr; });
+        });
+        run("destroy", [](size_t iterations) {
+            std::vector<Ptr> slots(std::min(iterations, kBatch));
+            double total = 0;
+            for (size_t done = 0; done < iterations;) {
+                size_t count = std::min(kBatch, iterations - done);
+                for (size_t i = 0; i < count; ++i) {
+                    slots[i] = Traits::template Make<P>();
+                }
+                Stopwatch watch;
+                for (size_t i = 0; i < count; ++i) {
+                    slots[i] = nullptr;
+                }
+                total += watch.ElapsedNs();
+                done += count;
+            }
+            return total;
+        });
+        run("reset_new", [](size_t iterations) {
+            Ptr ptr(new P);
+            Stopwatch watch;
+            for (size_t i = 0; i < iterations; ++i) {
+                Traits::Reset(ptr, new P);
+                DoNotOptimize(ptr);
+            }
+            return watch.ElapsedNs();
+        });
+        if (!refcount_ops) {
+            return;
+        }
+
+        run("copy", [](size_t iterations) {
+            Ptr source = Traits::template Make<P>();
+            Stopwatch watch;
+            for (size_t i = 0; i < iterations; ++i) {
+                Ptr copy(source);
+                DoNotOptimize(copy);
+            }
+            return watch.ElapsedNs();
+        });
+        run("move", [](size_t iterations) {
+            Ptr first = Traits::template Make<P>();
+            Stopwatch watch;
+            for (size_t i = 0; i < iterations; ++i) {
+                Ptr second(std::move(first));
+                DoNotOptimize(second);
+                first = std::move(second);
+            }
+            return watch.ElapsedNs();
+        });
+        run("swap", [](size_t iterations) {
+            Ptr first = Traits::template Make<P>(), second = Traits::template Make<P>();
+            Stopwatch watch;
+            for (size_t i = 0; i < iterations; ++i) {
+                Traits::Swap(first, second);
+                DoNotOptimize(first);
+            }
+            return watch.ElapsedNs();
+        });
+        run("reset_empty", [](size_t iterations) {
+            Ptr source = Traits::template Make<P>();
+            return Batched<Ptr>(iterations, [](Ptr& slot) { slot = nullptr; }, [&](Ptr& slot) { slot = source; });
+        });
+        run("aliasing", [](size_t iterations) {
+            Ptr source = Traits::template Make<P>();
+            Stopwatch watch;
+            for (size_t i = 0; i < iterations; ++i) {
+                typename Traits::template Ptr<char> alias(source, source->bytes + 1);
+                DoNotOptimize(alias);
+            }
+            return watch.ElapsedNs();
+        });
+        run("cast_to_const", [](size_t iterations) {
+            Ptr source = Traits::template Make<P>();
+            Stopwatch watch;
+            for (size_t i = 0; i < iterations; ++i) {
+                typename Traits::template Ptr<const P> cast(source);
+                DoNotOptimize(cast);
+            }
+            return watch.ElapsedNs();
+        });
+    }
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "shared.h"
+
+// Size-class pool for control blocks and other small shared allocations.
+// Every thread keeps a free list per size class and exchanges blocks with a central list in
+// batches; the central list carves new blocks out of large chunks. Chunks are never returned,
+// a block freed on another thread is simply reused there.
+class BlockPool {
+public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxBlockSize = 512;
+    static constexpr size_t kChunkSize = 64 * 1024;
+    static constexpr size_t kBatch = 32;
+    static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+    struct Stats {
+        size_t chunks = 0;
+        // 2 MiB-aligned regions mapped for chunks, and how many of them got MADV_HUGEPAGE / mlock
+        size_t regions = 0;
+        size_t huge_regions = 0;
+        size_t locked_regions = 0;
+    };
+
+    // Opt-in backend: new chunks are carved out of 2 MiB-aligned regions advised as transparent
+    // huge pages, so densely packed blocks share few TLB entries. With `lock` the regions are
+    // also mlock-ed. Falls back to operator new chunks when mapping fails; chunks handed out
+    // before the call stay where they are.
+    static void EnableHugePages(bool lock = false) {
+        Central& central = GetCentral();
+        std::lock_guard guard(central.mutex);
+        central.huge_pages = true;
+        central.lock_regions = lock;
+    }
+    static void DisableHugePages() {
+        Central& central = GetCentral();
+        std::lock_guard guard(central.mutex);
+        central.huge_pages = false;
+    }
+
+    static Stats GetStats() {
+        Central& central = GetCentral();
+        std::lock_guard guard(central.mutex);
+        return central.stats;
+    }
+
+    // Sizes above kMaxBlockSize go straight to operator new
+    static void* Allocate(size_t size) {
+        if (size == 0 || size > kMaxBlockSize) {
+            return ::operator new(size);
+        }
+        size_t index = ClassIndex(size);
+        LocalCache* cache = Local();
+        if (!cache) [[unlikely]] {
+            Central& central = GetCentral();
+            std::lock_guard lock(central.mutex);
+            return TakeLocked(central, index);
+        }
+        if (!cache->lists[index]) {
+            Refill(*cache, index);
+        }
+        FreeNode* node = cache->lists[index];
+        cache->lists[index] = node->next;
+        --cache->counts[index];
+        return node;
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        if (size == 0 || size > kMaxBlockSize) {
+            ::operator delete(ptr);
+            return;
+        }
+        size_t index = ClassIndex(size);
+        LocalCache* cache = Local();
+        auto node = static_cast<FreeNode*>(ptr);
+        if (!cache) [[unlikely]] {
+            Central& central = GetCentral();
+            std::lock_guard lock(central.mutex);
+            node->next = central.lists[index];
+            central.lists[index] = node;
+            return;
+        }
+        node->next = cache->lists[index];
+        cache->lists[index] = node;
+        if (++cache->counts[index] > 2 * kBatch) {
+            Flush(*cache, index, kBatch);
+        }
+    }
+
+private:
+    static constexpr size_t kClasses = kMaxBlockSize / kGranularity;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct Central {
+        std::mutex mutex;
+        FreeNode* lists[kClasses]{};
+        char* bump = nullptr;
+        char* bump_end = nullptr;
+        std::vector<void*> chunks;
+
+        bool huge_pages = false;
+        bool lock_regions = false;
+        char* region_bump = nullptr;
+        char* region_end = nullptr;
+        Stats stats;
+    };
+
+    struct LocalCache {
+        FreeNode* lists[kClasses]{};
+        size_t counts[kClasses]{};
+
+        ~LocalCache() {
+            Destroyed() = true;
+            for (size_t i = 0; i < kClasses; ++i) {
+                Flush(*this, i, counts[i]);
+            }
+        }
+    };
+
+    static size_t ClassIndex(size_t size) {
+        return (size - 1) / kGranularity;
+    }
+
+    // Intentionally leaked: blocks may be released by static destructors after any pool teardown
+    static Central& GetCentral() {
+        static Central* central = new Central;
+        return *central;
+    }
+
+    // Trivially destructible, so it can still be read after the thread's cache is gone
+    static bool& Destroyed() {
+        static thread_local bool destroyed = false;
+        return destroyed;
+    }
+
+    // Null once the thread's cache has been destroyed: thread-exit destructors (and static ones
+    // on the main thread) that still allocate or free pooled blocks use the central lists
+    static LocalCache* Local() {
+        if (Destroyed()) [[unlikely]] {
+            return nullptr;
+        }
+        static thread_local LocalCache cache;
+        return &cache;
+    }
+
+    // Called with the central mutex held
+    static FreeNode* TakeLocked(Central& central, size_t index) {
+        FreeNode* node = central.lists[index];
+        if (node) {
+            central.lists[index] = node->next;
+            return node;
+        }
+        size_t block_size = (index + 1) * kGranularity;
+        if (central.bump + block_size > central.bump_end) {
+            central.bump = NewChunk(central);
+            central.bump_end = central.bump + kChunkSize;
+        }
+        node = reinterpret_cast<FreeNode*>(central.bump);
+        central.bump += block_size;
+        return node;
+    }
+
+    static void Refill(LocalCache& cache, size_t index) {
+        Central& central = GetCentral();
+        std::lock_guard lock(central.mutex);
+        for (size_t i = 0; i < kBatch; ++i) {
+            FreeNode* node = TakeLocked(central, index);
+            node->next = cache.lists[index];
+            cache.lists[index] = node;
+            ++cache.counts[index];
+        }
+    }
+
+    // Called with the central mutex held
+    static char* NewChunk(Central& central) {
+        ++central.stats.chunks;
+        if (central.huge_pages && (central.region_bump != central.region_end || MapRegion(central))) {
+            char* chunk = central.region_bump;
+            central.region_bump += kChunkSize;
+            return chunk;
+        }
+        auto chunk = static_cast<char*>(::operator new(kChunkSize));
+        central.chunks.push_back(chunk);
+        return chunk;
+    }
+
+    // Maps twice the huge page size and trims it down to one aligned huge page
+    static bool MapRegion(Central& central) {
+        void* mapping = ::mmap(nullptr, 2 * kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                               -1, 0);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        auto begin = reinterpret_cast<uintptr_t>(mapping);
+        uintptr_t aligned = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        if (aligned != begin) {
+            ::munmap(mapping, aligned - begin);
+        }
+        ::munmap(reinterpret_cast<void*>(aligned + kHugePageSize), begin + kHugePageSize - aligned);
+
+        auto region = reinterpret_cast<char*>(aligned);
+        ++central.stats.regions;
+#ifdef MADV_HUGEPAGE
+        if (::madvise(region, kHugePageSize, MADV_HUGEPAGE) == 0) {
+            ++central.stats.huge_regions;
+        }
+#endif
+        if (central.lock_regions && ::mlock(region, kHugePageSize) == 0) {
+            ++central.stats.locked_regions;
+        }
+        central.region_bump = region;
+        central.region_end = region + kHugePageSize;
+        return true;
+    }
+
+    static void Flush(LocalCache& cache, size_t index, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        Central& central = GetCentral();
+        std::lock_guard lock(central.mutex);
+        for (size_t i = 0; i < count && cache.lists[index]; ++i) {
+            FreeNode* node = cache.lists[index];
+            cache.lists[index] = node->next;
+            --cache.counts[index];
+            node->next = central.lists[index];
+            central.lists[index] = node;
+        }
+    }
+};
+
+// ControlBlockHolder whose memory comes from BlockPool
+template <typename Y>
+class PooledControlBlockHolder : public ControlBlockHolder<Y> {
+public:
+    using ControlBlockHolder<Y>::ControlBlockHolder;
+
+    static void* operator new(size_t size) {
+        return BlockPool::Allocate(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        BlockPool::Deallocate(ptr, size);
+    }
+};
+
+// MakeShared with the control block taken from BlockPool; over-aligned types fall back to MakeShared
+template <typename Y, typename... Args>
+SharedPtr<Y> MakeSharedPooled(Args&&... args) {
+    if constexpr (alignof(Y) > BlockPool::kGranularity) {
+        return MakeShared<Y>(std::forward<Args>(args)...);
+    } else {
+        auto block = new PooledControlBlockHolder<Y>(std::forward<Args>(args)...);
+        return SharedPtr<Y>(block, block->GetRawPointer());
+    }
+}
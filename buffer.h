@@ -0,0 +1,180 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "shared.h"
+
+// Control block followed by the bytes it owns, one allocation per buffer
+class BufferControlBlock : public ControlBlockBase {
+public:
+    static BufferControlBlock* Create(size_t size) {
+        void* memory = ::operator new(sizeof(BufferControlBlock) + size);
+        return new (memory) BufferControlBlock();
+    }
+
+    std::byte* Bytes() {
+        return reinterpret_cast<std::byte*>(this + 1);
+    }
+
+    void DestroyObject() override {
+    }
+    void DestroyBlock() override {
+        this->~BufferControlBlock();
+        ::operator delete(static_cast<void*>(this));
+    }
+
+private:
+    BufferControlBlock() = default;
+};
+
+// Reference-counted view of bytes. Slices alias the control block of the buffer they were cut
+// from, so slicing and copying never copy data.
+class SharedBuffer {
+public:
+    SharedBuffer() = default;
+
+    static SharedBuffer Allocate(size_t size) {
+        auto block = BufferControlBlock::Create(size);
+        return SharedBuffer(SharedPtr<std::byte>(block, block->Bytes()), size);
+    }
+
+    static SharedBuffer Copy(const void* data, size_t size) {
+        auto buffer = Allocate(size);
+        std::memcpy(buffer.Data(), data, size);
+        return buffer;
+    }
+    static SharedBuffer Copy(std::string_view data) {
+        return Copy(data.data(), data.size());
+    }
+
+    // One read of up to `max` bytes; returns the filled part, empty on EOF or error (see errno)
+    static SharedBuffer ReadFrom(int fd, size_t max) {
+        auto buffer = Allocate(max);
+        ssize_t count = ::read(fd, buffer.Data(), max);
+        return buffer.Slice(0, count > 0 ? static_cast<size_t>(count) : 0);
+    }
+
+    SharedBuffer Slice(size_t offset, size_t length) const {
+        assert(offset + length <= size_);
+        return SharedBuffer(SharedPtr<std::byte>(data_, data_.Get() + offset), length);
+    }
+    SharedBuffer Slice(size_t offset) const {
+        return Slice(offset, size_ - offset);
+    }
+
+    std::byte* Data() const {
+        return data_.Get();
+    }
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+    std::string_view View() const {
+        return std::string_view(reinterpret_cast<const char*>(data_.Get()), size_);
+    }
+
+    // Number of buffers and slices sharing the underlying bytes
+    size_t UseCount() const {
+        return data_.UseCount();
+    }
+
+private:
+    SharedBuffer(SharedPtr<std::byte> data, size_t size) : data_(std::move(data)), size_(size) {
+    }
+
+    SharedPtr<std::byte> data_;
+    size_t size_ = 0;
+};
+
+// Sequence of slices written out with writev, without gathering them into one buffer
+class BufferChain {
+public:
+    void Append(SharedBuffer buffer) {
+        if (!buffer.Empty()) {
+            size_ += buffer.Size();
+            buffers_.push_back(std::move(buffer));
+        }
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Fills up to `count` iovecs, returns how many were used
+    size_t FillIovec(iovec* iov, size_t count) const {
+        size_t used = 0;
+        for (size_t i = head_; i < buffers_.size() && used < count; ++i, ++used) {
+            iov[used].iov_base = buffers_[i].Data();
+            iov[used].iov_len = buffers_[i].Size();
+        }
+        return used;
+    }
+
+    // Drops `bytes` from the front of the chain
+    void Consume(size_t bytes) {
+        assert(bytes <= size_);
+        size_ -= bytes;
+        while (bytes > 0) {
+            SharedBuffer& front = buffers_[head_];
+            if (bytes < front.Size()) {
+                front = front.Slice(bytes);
+                return;
+            }
+            bytes -= front.Size();
+            front = SharedBuffer();
+            ++head_;
+        }
+        if (head_ == buffers_.size()) {
+            buffers_.clear();
+            head_ = 0;
+        }
+    }
+
+    // One writev call; consumes what was written and returns its result
+    ssize_t WriteTo(int fd) {
+        iovec iov[kMaxIovec];
+        size_t count = FillIovec(iov, kMaxIovec);
+        if (count == 0) {
+            return 0;
+        }
+        ssize_t written = ::writev(fd, iov, static_cast<int>(count));
+        if (written > 0) {
+            Consume(static_cast<size_t>(written));
+        }
+        return written;
+    }
+
+    // Writes the whole chain, retrying on partial writes and EINTR; returns false on error
+    bool WriteAllTo(int fd) {
+        while (!Empty()) {
+            if (WriteTo(fd) < 0 && errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t kMaxIovec = IOV_MAX < 1024 ? IOV_MAX : 1024;
+
+    std::vector<SharedBuffer> buffers_;
+    // Buffers before `head_` are already consumed
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
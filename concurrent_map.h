@@ -0,0 +1,249 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "epoch.h"
+#include "shared.h"
+
+// Concurrent open-addressing map from K to SharedPtr<V>.
+// `Find` never takes a lock: it pins the reclamation epoch, probes the current table of the
+// shard and copies the SharedPtr out of an immutable node. Writers are serialized per shard;
+// replaced or erased nodes and outgrown tables are retired through EpochDomain, so a reader
+// that is still probing them keeps them alive. Due collections run after the shard lock is
+// released, so destructors of dropped values never run under it. Growing a shard rehashes only
+// that shard while readers keep using the old table until the new one is published.
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class ConcurrentSharedMap {
+public:
+    explicit ConcurrentSharedMap(size_t shard_count = 16, size_t shard_capacity = 16)
+            : shard_count_(RoundUpToPowerOfTwo(shard_count)),
+              shards_(new Shard[shard_count_]) {
+        for (size_t i = 0; i < shard_count_; ++i) {
+            shards_[i].table.store(new Table(RoundUpToPowerOfTwo(shard_capacity)),
+                                   std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentSharedMap(const ConcurrentSharedMap&) = delete;
+    ConcurrentSharedMap& operator=(const ConcurrentSharedMap&) = delete;
+
+    ~ConcurrentSharedMap() {
+        for (size_t i = 0; i < shard_count_; ++i) {
+            Table* table = shards_[i].table.load(std::memory_order_relaxed);
+            for (size_t j = 0; j <= table->mask; ++j) {
+                Node* node = table->slots[j].load(std::memory_order_relaxed);
+                if (node && node != Tombstone()) {
+                    delete node;
+                }
+            }
+            delete table;
+        }
+    }
+
+    // Lock-free lookup, returns an empty pointer if the key is absent
+    SharedPtr<V> Find(const K& key) const {
+        size_t hash = Mix(Hash{}(key));
+        const Shard& shard = ShardFor(hash);
+
+        EpochDomain::Guard guard;
+        Table* table = shard.table.load(std::memory_order_acquire);
+        for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+            Node* node = table->slots[i].load(std::memory_order_acquire);
+            if (!node) {
+                return nullptr;
+            }
+            if (node != Tombstone() && node->hash == hash && KeyEqual{}(node->key, key)) {
+                return node->value;
+            }
+        }
+    }
+
+    // Inserts or replaces the value, returns the previous one
+    SharedPtr<V> InsertOrAssign(const K& key, SharedPtr<V> value) {
+        size_t hash = Mix(Hash{}(key));
+        Shard& shard = ShardFor(hash);
+        EpochDomain::DeferredCollect collect;
+        std::lock_guard lock(shard.mutex);
+
+        Node* node = new Node{hash, key, std::move(value)};
+        std::atomic<Node*>& slot = LocateForInsert(shard, hash, key);
+        Node* old = slot.load(std::memory_order_relaxed);
+        slot.store(node, std::memory_order_release);
+
+        if (old && old != Tombstone()) {
+            SharedPtr<V> previous = old->value;
+            EpochDomain::Global().Retire(old);
+            return previous;
+        }
+        if (!old) {
+            ++shard.used;
+        }
+        shard.size.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // Inserts the value only if the key is absent, returns whether it was inserted
+    bool Insert(const K& key, SharedPtr<V> value) {
+        size_t hash = Mix(Hash{}(key));
+        Shard& shard = ShardFor(hash);
+        EpochDomain::DeferredCollect collect;
+        std::lock_guard lock(shard.mutex);
+
+        std::atomic<Node*>& slot = LocateForInsert(shard, hash, key);
+        Node* old = slot.load(std::memory_order_relaxed);
+        if (old && old != Tombstone()) {
+            return false;
+        }
+        slot.store(new Node{hash, key, std::move(value)}, std::memory_order_release);
+        if (!old) {
+            ++shard.used;
+        }
+        shard.size.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Removes the key, returns the erased value
+    SharedPtr<V> Erase(const K& key) {
+        size_t hash = Mix(Hash{}(key));
+        Shard& shard = ShardFor(hash);
+        EpochDomain::DeferredCollect collect;
+        std::lock_guard lock(shard.mutex);
+
+        Table* table = shard.table.load(std::memory_order_relaxed);
+        for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+            Node* node = table->slots[i].load(std::memory_order_relaxed);
+            if (!node) {
+                return nullptr;
+            }
+            if (node != Tombstone() && node->hash == hash && KeyEqual{}(node->key, key)) {
+                table->slots[i].store(Tombstone(), std::memory_order_release);
+                shard.size.fetch_sub(1, std::memory_order_relaxed);
+                SharedPtr<V> previous = node->value;
+                EpochDomain::Global().Retire(node);
+                return previous;
+            }
+        }
+    }
+
+    size_t Size() const {
+        size_t size = 0;
+        for (size_t i = 0; i < shard_count_; ++i) {
+            size += shards_[i].size.load(std::memory_order_relaxed);
+        }
+        return size;
+    }
+
+private:
+    // Nodes are immutable once published, so readers may copy `value` without a lock
+    struct Node {
+        size_t hash;
+        K key;
+        SharedPtr<V> value;
+    };
+
+    struct Table {
+        explicit Table(size_t capacity) : mask(capacity - 1), slots(new std::atomic<Node*>[capacity]) {
+            for (size_t i = 0; i < capacity; ++i) {
+                slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<Node*>[]> slots;
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<Table*> table{nullptr};
+        std::atomic<size_t> size{0};
+        size_t used = 0;  // live nodes and tombstones, guarded by `mutex`
+        std::mutex mutex;
+    };
+
+    static Node* Tombstone() {
+        alignas(Node) static char tombstone;
+        return reinterpret_cast<Node*>(&tombstone);
+    }
+
+    // fmix64 from MurmurHash3, std::hash is the identity for integers
+    static size_t Mix(size_t hash) {
+        uint64_t h = hash;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return static_cast<size_t>(h);
+    }
+
+    static size_t RoundUpToPowerOfTwo(size_t n) {
+        size_t result = 1;
+        while (result < n) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    Shard& ShardFor(size_t hash) const {
+        // The top bits pick the shard, the bottom bits pick the slot inside of it
+        return shards_[(hash >> 48) & (shard_count_ - 1)];
+    }
+
+    // Returns the slot holding `key`, or an empty slot to put it into. Called under the shard lock.
+    std::atomic<Node*>& LocateForInsert(Shard& shard, size_t hash, const K& key) {
+        Table* table = shard.table.load(std::memory_order_relaxed);
+        if ((shard.used + 1) * 4 > (table->mask + 1) * 3) {
+            table = Rehash(shard, table);
+        }
+
+        std::atomic<Node*>* tombstone = nullptr;
+        for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+            Node* node = table->slots[i].load(std::memory_order_relaxed);
+            if (!node) {
+                return tombstone ? *tombstone : table->slots[i];
+            }
+            if (node == Tombstone()) {
+                if (!tombstone) {
+                    tombstone = &table->slots[i];
+                }
+            } else if (node->hash == hash && KeyEqual{}(node->key, key)) {
+                return table->slots[i];
+            }
+        }
+    }
+
+    // Builds a new table without tombstones and publishes it; readers of the old one are unaffected
+    Table* Rehash(Shard& shard, Table* old) {
+        size_t live = shard.size.load(std::memory_order_relaxed);
+        size_t capacity = old->mask + 1;
+        if ((live + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+
+        Table* table = new Table(capacity);
+        for (size_t i = 0; i <= old->mask; ++i) {
+            Node* node = old->slots[i].load(std::memory_order_relaxed);
+            if (!node || node == Tombstone()) {
+                continue;
+            }
+            size_t j = node->hash & table->mask;
+            while (table->slots[j].load(std::memory_order_relaxed)) {
+                j = (j + 1) & table->mask;
+            }
+            table->slots[j].store(node, std::memory_order_relaxed);
+        }
+
+        shard.table.store(table, std::memory_order_release);
+        shard.used = live;
+        EpochDomain::Global().Retire(old);
+        return table;
+    }
+
+    size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+};
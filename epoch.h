@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation.
+// Readers pin the current epoch with a `Guard` for the duration of a lock-free traversal.
+// Writers `Retire` nodes they have already unlinked; a retired node is freed once the global
+// epoch has advanced twice past the epoch it was retired in, i.e. when no pinned reader can
+// still hold a pointer to it. There is a single process-wide domain.
+// Each thread pins through its own slot; a slot is released when its thread exits. Threads
+// beyond kMaxThreads pin through a shared counter instead, which holds the epoch back while
+// any of them is pinned.
+class EpochDomain {
+public:
+    static constexpr size_t kMaxThreads = 256;
+    static constexpr size_t kCollectPeriod = 64;
+
+    class Guard {
+    public:
+        Guard() {
+            Global().Pin();
+        }
+        ~Guard() {
+            Global().Unpin();
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    // Runs a due collection when it goes out of scope. Writers that retire under their own
+    // lock declare it before taking the lock, so deleters run after the lock is released.
+    class DeferredCollect {
+    public:
+        DeferredCollect() = default;
+        ~DeferredCollect() {
+            Global().CollectIfDue();
+        }
+
+        DeferredCollect(const DeferredCollect&) = delete;
+        DeferredCollect& operator=(const DeferredCollect&) = delete;
+    };
+
+    static EpochDomain& Global() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    ~EpochDomain() {
+        for (auto& retired : retired_) {
+            retired.deleter(retired.ptr);
+        }
+    }
+
+    // Queues `ptr` for deletion; never runs deleters itself. Every kCollectPeriod retirements a
+    // collection becomes due, which the next CollectIfDue (or DeferredCollect) performs.
+    void Retire(void* ptr, void (*deleter)(void*)) {
+        std::lock_guard lock(mutex_);
+        retired_.push_back({ptr, deleter, global_epoch_.load(std::memory_order_seq_cst)});
+        if (retired_.size() % kCollectPeriod == 0) {
+            collect_due_.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename T>
+    void Retire(T* ptr) {
+        Retire(ptr, [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    void CollectIfDue() {
+        if (collect_due_.load(std::memory_order_relaxed) &&
+            collect_due_.exchange(false, std::memory_order_relaxed)) {
+            Collect();
+        }
+    }
+
+    // Tries to advance the epoch and frees everything that became unreachable
+    void Collect() {
+        TryAdvance();
+
+        std::vector<Retired> ready;
+        {
+            std::lock_guard lock(mutex_);
+            uint64_t epoch = global_epoch_.load(std::memory_order_acquire);
+            size_t kept = 0;
+            for (auto& retired : retired_) {
+                if (retired.epoch + 2 <= epoch) {
+                    ready.push_back(retired);
+                } else {
+                    retired_[kept++] = retired;
+                }
+            }
+            retired_.resize(kept);
+        }
+        // Deleters may drop the last reference of a SharedPtr and run arbitrary destructors,
+        // so they are called outside of the lock
+        for (auto& retired : ready) {
+            retired.deleter(retired.ptr);
+        }
+    }
+
+    // Frees everything retired so far. Must not be called while the calling thread holds a Guard.
+    void Drain() {
+        for (;;) {
+            {
+                std::lock_guard lock(mutex_);
+                if (retired_.empty()) {
+                    return;
+                }
+            }
+            Collect();
+        }
+    }
+
+private:
+    EpochDomain() = default;
+
+    static constexpr uint64_t kInactive = UINT64_MAX;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{kInactive};
+        std::atomic<bool> in_use{false};
+    };
+
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    // Per-thread registration, released when the thread exits. `slot` stays null while all
+    // slots are taken, and is retried on every outermost Pin.
+    struct ThreadState {
+        Slot* slot = nullptr;
+        size_t depth = 0;
+
+        ~ThreadState() {
+            if (slot) {
+                slot->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    // Returns nullptr when all kMaxThreads slots are in use
+    Slot* AcquireSlot() {
+        for (auto& slot : slots_) {
+            bool expected = false;
+            if (!slot.in_use.load(std::memory_order_relaxed) &&
+                slot.in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    static ThreadState& LocalState() {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    void Pin() {
+        auto& state = LocalState();
+        if (state.depth++ != 0) {
+            return;
+        }
+        if (!state.slot) {
+            state.slot = AcquireSlot();
+        }
+        if (!state.slot) {
+            // TryAdvance checks the counter after the slots, so the epoch cannot move twice
+            // while we are pinned
+            overflow_pins_.fetch_add(1, std::memory_order_seq_cst);
+            return;
+        }
+        // Re-check after publishing so that the pinned epoch is never stale
+        uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+        for (;;) {
+            state.slot->epoch.store(epoch, std::memory_order_seq_cst);
+            uint64_t current = global_epoch_.load(std::memory_order_seq_cst);
+            if (current == epoch) {
+                break;
+            }
+            epoch = current;
+        }
+    }
+
+    void Unpin() {
+        auto& state = LocalState();
+        if (--state.depth != 0) {
+            return;
+        }
+        if (state.slot) {
+            state.slot->epoch.store(kInactive, std::memory_order_release);
+        } else {
+            overflow_pins_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void TryAdvance() {
+        uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+        for (auto& slot : slots_) {
+            uint64_t pinned = slot.epoch.load(std::memory_order_seq_cst);
+            if (pinned != kInactive && pinned != epoch) {
+                return;
+            }
+        }
+        if (overflow_pins_.load(std::memory_order_seq_cst) != 0) {
+            return;
+        }
+        global_epoch_.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+    }
+
+    alignas(64) std::atomic<uint64_t> global_epoch_{0};
+    Slot slots_[kMaxThreads];
+    alignas(64) std::atomic<size_t> overflow_pins_{0};
+    std::atomic<bool> collect_due_{false};
+
+    std::mutex mutex_;
+    std::vector<Retired> retired_;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <ranges>
+#include <string>
+#include <utility>
+
+#include "shared.h"
+
+// Preforking support. Reference counts live in the control block, right next to the object, so
+// every copy made in a forked worker dirties a copy-on-write page and worker RSS grows with the
+// number of objects it merely touches. Freezing the tables before fork makes their objects
+// immortal: workers then only read the control blocks and the pages stay shared.
+// Frozen objects are never freed, also not in the parent.
+
+template <typename T>
+void FreezeForFork(const SharedPtr<T>& ptr) {
+    ptr.MakeImmortal();
+}
+
+// Map entries freeze their values
+template <typename K, typename V>
+void FreezeForFork(const std::pair<K, V>& entry) {
+    FreezeForFork(entry.second);
+}
+
+// Containers of pointers, of entries or of nested containers
+template <typename Range>
+    requires std::ranges::input_range<const Range>
+void FreezeForFork(const Range& range) {
+    for (const auto& element : range) {
+        FreezeForFork(element);
+    }
+}
+
+template <typename First, typename Second, typename... Rest>
+void FreezeForFork(const First& first, const Second& second, const Rest&... rest) {
+    FreezeForFork(first);
+    FreezeForFork(second);
+    (FreezeForFork(rest), ...);
+}
+
+// Private dirty memory of the calling process from /proc/self/smaps_rollup, 0 if unavailable.
+// Compare it in a worker before and after a pass over the shared tables.
+inline size_t PrivateDirtyBytes() {
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    std::string key;
+    std::string unit;
+    size_t total = 0;
+    size_t kilobytes;
+    while (rollup >> key) {
+        if (key == "Private_Dirty:" && rollup >> kilobytes >> unit) {
+            total += kilobytes * 1024;
+        }
+    }
+    return total;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "shared.h"
+
+// Promise/future pair whose shared state, result storage and one continuation live in a single
+// MakeShared allocation. Setting the value and attaching the continuation each publish one flag
+// with `fetch_or`; whichever side comes second runs the continuation, so no lock is taken.
+template <typename T>
+class SharedFuture;
+
+template <typename T>
+class SharedPromise;
+
+template <typename T>
+class FutureState {
+public:
+    // Continuations up to this size are stored inline, larger ones are heap allocated
+    static constexpr size_t kInlineSize = 48;
+
+    FutureState() = default;
+    FutureState(const FutureState&) = delete;
+    FutureState& operator=(const FutureState&) = delete;
+
+    ~FutureState() {
+        uint32_t status = status_.load(std::memory_order_acquire);
+        if (status & kValue) {
+            GetValue().~T();
+        }
+        if (destroy_) {
+            destroy_(continuation_);
+        }
+    }
+
+    template <typename... Args>
+    void SetValue(Args&&... args) {
+        new (&storage_) T(std::forward<Args>(args)...);
+        uint32_t previous = status_.fetch_or(kValue, std::memory_order_acq_rel);
+        assert(!(previous & kValue));
+        if (previous & kWaiter) {
+            status_.notify_all();
+        }
+        if (previous & kContinuation) {
+            RunContinuation();
+        }
+    }
+
+    template <typename F>
+    void Then(F&& f) {
+        using Callable = std::decay_t<F>;
+        if constexpr (sizeof(Callable) <= kInlineSize && alignof(Callable) <= alignof(std::max_align_t)) {
+            new (continuation_) Callable(std::forward<F>(f));
+            invoke_ = [](void* storage, const T& value) { (*static_cast<Callable*>(storage))(value); };
+            destroy_ = [](void* storage) { static_cast<Callable*>(storage)->~Callable(); };
+        } else {
+            *reinterpret_cast<Callable**>(continuation_) = new Callable(std::forward<F>(f));
+            invoke_ = [](void* storage, const T& value) { (**static_cast<Callable**>(storage))(value); };
+            destroy_ = [](void* storage) { delete *static_cast<Callable**>(storage); };
+        }
+        uint32_t previous = status_.fetch_or(kContinuation, std::memory_order_acq_rel);
+        assert(!(previous & kContinuation));
+        if (previous & kValue) {
+            RunContinuation();
+        }
+    }
+
+    bool IsReady() const {
+        return status_.load(std::memory_order_acquire) & kValue;
+    }
+
+    // Announces itself before sleeping, so SetValue only notifies when somebody waits
+    void Wait() const {
+        uint32_t status = status_.load(std::memory_order_acquire);
+        while (!(status & kValue)) {
+            status = status_.fetch_or(kWaiter, std::memory_order_acq_rel) | kWaiter;
+            if (status & kValue) {
+                break;
+            }
+            status_.wait(status, std::memory_order_acquire);
+            status = status_.load(std::memory_order_acquire);
+        }
+    }
+
+    const T& GetValue() const {
+        return *reinterpret_cast<const T*>(&storage_);
+    }
+    T& GetValue() {
+        return *reinterpret_cast<T*>(&storage_);
+    }
+
+private:
+    static constexpr uint32_t kValue = 1;
+    static constexpr uint32_t kContinuation = 2;
+    static constexpr uint32_t kWaiter = 4;
+
+    void RunContinuation() {
+        invoke_(continuation_, GetValue());
+        destroy_(continuation_);
+        destroy_ = nullptr;
+    }
+
+    mutable std::atomic<uint32_t> status_{0};
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+    void (*invoke_)(void*, const T&) = nullptr;
+    void (*destroy_)(void*) = nullptr;
+    alignas(std::max_align_t) unsigned char continuation_[kInlineSize];
+};
+
+template <typename T>
+class SharedPromise {
+public:
+    SharedPromise() : state_(MakeShared<FutureState<T>>()) {
+    }
+
+    SharedFuture<T> GetFuture() const {
+        return SharedFuture<T>(state_);
+    }
+
+    // Must be called exactly once; futures wait until it is
+    template <typename... Args>
+    void SetValue(Args&&... args) {
+        state_->SetValue(std::forward<Args>(args)...);
+    }
+
+private:
+    SharedPtr<FutureState<T>> state_;
+};
+
+// Copyable, every copy observes the same result. Apart from operator bool, members require a
+// future obtained from SharedPromise::GetFuture, not a default-constructed one.
+template <typename T>
+class SharedFuture {
+public:
+    SharedFuture() = default;
+
+    void Wait() const {
+        assert(state_);
+        state_->Wait();
+    }
+    bool IsReady() const {
+        assert(state_);
+        return state_->IsReady();
+    }
+    const T& Get() const {
+        assert(state_);
+        state_->Wait();
+        return state_->GetValue();
+    }
+
+    // Calls `f(const T&)` once the value is set, either right here or from SetValue.
+    // At most one continuation per shared state.
+    template <typename F>
+    void Then(F&& f) const {
+        assert(state_);
+        state_->Then(std::forward<F>(f));
+    }
+
+    explicit operator bool() const {
+        return static_cast<bool>(state_);
+    }
+
+private:
+    friend class SharedPromise<T>;
+
+    explicit SharedFuture(SharedPtr<FutureState<T>> state) : state_(std::move(state)) {
+    }
+
+    SharedPtr<FutureState<T>> state_;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "shared.h"
+
+// Hash-consing factory: `Intern(value)` returns the live SharedPtr<const T> equal to `value`
+// if there is one and allocates a new object otherwise.
+// Table entries hold only a weak reference on the control block. The block of an interned
+// object removes its own entry when the last strong reference is dropped, before the object
+// is destroyed, so the table never outgrows the set of live values.
+template <typename T, typename Hash = std::hash<T>, typename KeyEqual = std::equal_to<T>>
+class Interner {
+public:
+    explicit Interner(size_t shard_count = 16) : state_(MakeShared<State>(shard_count)) {
+    }
+
+    Interner(const Interner&) = delete;
+    Interner& operator=(const Interner&) = delete;
+
+    SharedPtr<const T> Intern(const T& value) {
+        return InternImpl(value);
+    }
+    SharedPtr<const T> Intern(T&& value) {
+        return InternImpl(std::move(value));
+    }
+
+    // Number of distinct live values
+    size_t Size() const {
+        size_t size = 0;
+        for (size_t i = 0; i <= state_->mask; ++i) {
+            std::lock_guard lock(state_->shards[i].mutex);
+            size += state_->shards[i].entries.size();
+        }
+        return size;
+    }
+
+private:
+    class Block;
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_multimap<size_t, Block*> entries;
+    };
+
+    // Shared by the interner and every interned block, so blocks may outlive the interner
+    struct State {
+        explicit State(size_t shard_count) {
+            size_t count = 1;
+            while (count < shard_count) {
+                count <<= 1;
+            }
+            shards.reset(new Shard[count]);
+            mask = count - 1;
+        }
+
+        Shard& ShardFor(size_t hash) {
+            return shards[(static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL >> 40) & mask];
+        }
+
+        std::unique_ptr<Shard[]> shards;
+        size_t mask;
+    };
+
+    class Block : public ControlBlockHolder<T> {
+    public:
+        template <typename U>
+        Block(SharedPtr<State> state, size_t hash, U&& value)
+                : ControlBlockHolder<T>(std::forward<U>(value)), state_(std::move(state)), hash_(hash) {
+        }
+
+        void DestroyObject() override {
+            bool erased = false;
+            {
+                Shard& shard = state_->ShardFor(hash_);
+                std::lock_guard lock(shard.mutex);
+                auto [begin, end] = shard.entries.equal_range(hash_);
+                for (auto it = begin; it != end; ++it) {
+                    // A concurrent Intern may have already replaced the dying entry
+                    if (it->second == this) {
+                        shard.entries.erase(it);
+                        erased = true;
+                        break;
+                    }
+                }
+            }
+            if (erased) {
+                // Never the last weak reference: the strong ones still hold theirs
+                this->DecWeak();
+            }
+            ControlBlockHolder<T>::DestroyObject();
+            state_.Reset();
+        }
+
+    private:
+        SharedPtr<State> state_;
+        size_t hash_;
+    };
+
+    template <typename U>
+    SharedPtr<const T> InternImpl(U&& value) {
+        size_t hash = Hash{}(value);
+        Shard& shard = state_->ShardFor(hash);
+        std::lock_guard lock(shard.mutex);
+
+        auto [begin, end] = shard.entries.equal_range(hash);
+        for (auto it = begin; it != end; ++it) {
+            Block* block = it->second;
+            // The object cannot be destroyed while we hold the shard lock, so comparing is safe
+            if (!KeyEqual{}(*block->GetRawPointer(), value)) {
+                continue;
+            }
+            if (block->TryIncRef()) {
+                return SharedPtr<const T>(block, block->GetRawPointer());
+            }
+            // The last strong reference is gone and the block is waiting for the lock to unlink
+            // itself; take its place instead
+            shard.entries.erase(it);
+            block->DecWeak();
+            break;
+        }
+
+        auto block = new Block(state_, hash, std::forward<U>(value));
+        block->IncWeak();
+        shard.entries.emplace(hash, block);
+        return SharedPtr<const T>(block, block->GetRawPointer());
+    }
+
+    SharedPtr<State> state_;
+};
@@ -0,0 +1,541 @@
+#pragma once
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "offset_ptr.h"
+#include "shared.h"
+
+template <typename T>
+class InterprocessSharedPtr;
+
+// Header of every object allocated in a segment. `strong` counts all references and alone
+// decides when the block is freed. Each attached process also tallies its own references in its
+// slot, so those of a process that died can be subtracted from `strong`. References are added to
+// `strong` before the slot and dropped from the slot first: a process dying in between leaves
+// `strong` too high, which leaks the block instead of freeing it under someone else.
+struct SegmentBlock {
+    static constexpr size_t kCounterSlots = 16;
+
+    std::atomic<uint64_t> strong;
+    std::atomic<uint32_t> counts[kCounterSlots];
+    // Even while allocated, odd once freed; whoever drops `strong` to zero, or finds it there
+    // when reaping, must win the increment to free the block. Stable while holding a reference.
+    std::atomic<uint32_t> generation;
+    uint32_t size_class;
+    // Live block list, or the free list once freed
+    uint64_t prev;
+    uint64_t next;
+
+    void* Object() {
+        return this + 1;
+    }
+
+    size_t UseCount() const {
+        return strong.load(std::memory_order_relaxed);
+    }
+
+    void AddRef(size_t slot, uint32_t count = 1) {
+        strong.fetch_add(count, std::memory_order_relaxed);
+        counts[slot].fetch_add(count, std::memory_order_relaxed);
+    }
+};
+
+// Shared memory segment (POSIX shm or anonymous shared mapping) holding reference-counted
+// objects that several processes use through InterprocessSharedPtr.
+// - Objects are allocated by a segment allocator (power-of-two classes, free lists and a bump
+//   pointer) protected by a robust process-shared mutex.
+// - Every process attaches to one of kMaxProcesses counter slots. References stored in the
+//   segment's root table are counted in a separate slot and survive every process.
+// - Reap drops the references of processes that died and frees what only they held. A process
+//   counts as dead when its pid is gone or now belongs to a process started at another time. One
+//   that dies inside the allocator may leave its free lists inconsistent.
+// Objects are destroyed by whichever process releases them last, or by Reap which does not know
+// their type, so they must be trivially destructible and keep internal pointers as OffsetPtr.
+class SharedSegment {
+public:
+    static constexpr size_t kMaxProcesses = SegmentBlock::kCounterSlots - 1;
+    static constexpr size_t kRoots = 16;
+
+    // For sharing with children created by Fork
+    static SharedPtr<SharedSegment> CreateAnonymous(size_t size) {
+        void* base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            return nullptr;
+        }
+        return Initialize(base, size);
+    }
+
+    // Named POSIX shm segment; fails if it already exists. Empty pointer on error, see errno.
+    static SharedPtr<SharedSegment> Create(const std::string& name, size_t size) {
+        int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            return nullptr;
+        }
+        void* base = MAP_FAILED;
+        if (::ftruncate(fd, static_cast<off_t>(size)) == 0) {
+            base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        int error = errno;
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            ::shm_unlink(name.c_str());
+            errno = error;
+            return nullptr;
+        }
+        return Initialize(base, size);
+    }
+
+    // Attaches to a segment made by Create, wherever it ends up mapped
+    static SharedPtr<SharedSegment> Open(const std::string& name) {
+        int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat status;
+        void* base = MAP_FAILED;
+        if (::fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(Header)) {
+            base = ::mmap(nullptr, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        } else {
+            errno = EINVAL;
+        }
+        int error = errno;
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            errno = error;
+            return nullptr;
+        }
+        auto header = static_cast<Header*>(base);
+        if (header->magic.load(std::memory_order_acquire) != kMagic) {
+            ::munmap(base, status.st_size);
+            errno = EINVAL;
+            return nullptr;
+        }
+        return Attach(base, status.st_size);
+    }
+
+    static bool Remove(const std::string& name) {
+        return ::shm_unlink(name.c_str()) == 0;
+    }
+
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+
+    // Drops the references this process still counts, then unmaps
+    ~SharedSegment() {
+        {
+            Lock lock(header_);
+            ReapSlotLocked(slot_);
+        }
+        ::munmap(base_, size_);
+    }
+
+    // Empty pointer when the segment is full
+    template <typename T, typename... Args>
+    InterprocessSharedPtr<T> Make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "segment objects are destroyed without their type");
+        static_assert(alignof(T) <= alignof(SegmentBlock), "over-aligned segment object");
+        SegmentBlock* block = Allocate(sizeof(SegmentBlock) + sizeof(T));
+        if (!block) {
+            return InterprocessSharedPtr<T>();
+        }
+        new (block->Object()) T(std::forward<Args>(args)...);
+        return InterprocessSharedPtr<T>(this, block);
+    }
+
+    // Takes a reference to the object at `offset` (from InterprocessSharedPtr::Offset), e.g. one
+    // received from another process. Somebody must hold it until this returns.
+    template <typename T>
+    InterprocessSharedPtr<T> Acquire(uint64_t offset) {
+        SegmentBlock* block = BlockAt(offset);
+        block->AddRef(slot_);
+        return InterprocessSharedPtr<T>(this, block);
+    }
+
+    // Roots hold their own references and are how unrelated processes find shared objects
+    template <typename T>
+    void SetRoot(size_t index, const InterprocessSharedPtr<T>& ptr) {
+        assert(index < kRoots);
+        uint64_t previous;
+        {
+            Lock lock(header_);
+            if (ptr) {
+                ptr.block_->AddRef(kRootSlot);
+            }
+            previous = header_->roots[index];
+            header_->roots[index] = ptr ? OffsetOf(ptr.block_) : 0;
+        }
+        if (previous) {
+            Release(BlockAt(previous), kRootSlot);
+        }
+    }
+    template <typename T>
+    InterprocessSharedPtr<T> GetRoot(size_t index) {
+        assert(index < kRoots);
+        Lock lock(header_);
+        if (!header_->roots[index]) {
+            return InterprocessSharedPtr<T>();
+        }
+        SegmentBlock* block = BlockAt(header_->roots[index]);
+        block->AddRef(slot_);
+        return InterprocessSharedPtr<T>(this, block);
+    }
+
+    // fork() whose child gets its own counter slot, seeded with the parent's counts since the child
+    // starts with copies of all the parent's pointers. Other threads of the parent must not copy
+    // or drop pointers into the segment meanwhile. Returns -1 with errno set when no slot is free.
+    pid_t Fork() {
+        size_t child_slot;
+        {
+            Lock lock(header_);
+            child_slot = FreeSlotLocked();
+            if (child_slot == kMaxProcesses) {
+                errno = EAGAIN;
+                return -1;
+            }
+            for (uint64_t offset = header_->blocks; offset;) {
+                SegmentBlock* block = BlockAt(offset);
+                block->AddRef(child_slot, block->counts[slot_].load(std::memory_order_relaxed));
+                offset = block->next;
+            }
+        }
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            slot_ = child_slot;
+        }
+        if (pid < 0) {
+            int error = errno;
+            Lock lock(header_);
+            ReapSlotLocked(child_slot);
+            errno = error;
+        } else {
+            // Both sides store the same values, whichever comes first
+            pid_t child = pid == 0 ? ::getpid() : pid;
+            header_->start_times[child_slot].store(ProcessStartTime(child), std::memory_order_relaxed);
+            header_->pids[child_slot].store(child, std::memory_order_release);
+        }
+        return pid;
+    }
+
+    // Drops the references of attached processes that no longer exist (children must already be
+    // waited for) and frees blocks nobody references; returns the number of processes reaped
+    size_t Reap() {
+        Lock lock(header_);
+        size_t reaped = 0;
+        for (size_t slot = 0; slot < kMaxProcesses; ++slot) {
+            pid_t pid = header_->pids[slot].load(std::memory_order_acquire);
+            if (pid > 0 && !Alive(pid, header_->start_times[slot].load(std::memory_order_relaxed))) {
+                ReapSlotLocked(slot);
+                ++reaped;
+            }
+        }
+        ReapSlotLocked(kMaxProcesses);
+        return reaped;
+    }
+
+    size_t LiveBlocks() {
+        Lock lock(header_);
+        return header_->live_blocks;
+    }
+
+private:
+    template <typename T>
+    friend class InterprocessSharedPtr;
+
+    static constexpr uint64_t kMagic = 0x6d795f7365676d32;  // "my_segm2"
+    static constexpr size_t kRootSlot = kMaxProcesses;
+    static constexpr size_t kMinBlockSize = 128;
+    static constexpr size_t kClasses = 32;
+    // Marks a slot taken by Fork before the child's pid is known
+    static constexpr pid_t kReserved = -1;
+
+    struct Header {
+        std::atomic<uint64_t> magic;
+        uint64_t size;
+        pthread_mutex_t mutex;
+        uint64_t bump;
+        uint64_t free_lists[kClasses];
+        uint64_t blocks;
+        uint64_t live_blocks;
+        std::atomic<pid_t> pids[kMaxProcesses];
+        // Of the process in each slot, stored before its pid; 0 if unknown
+        std::atomic<uint64_t> start_times[kMaxProcesses];
+        uint64_t roots[kRoots];
+    };
+
+    // Robust: a process that dies holding the mutex passes it on instead of deadlocking everyone
+    class Lock {
+    public:
+        explicit Lock(Header* header) : mutex_(&header->mutex) {
+            if (::pthread_mutex_lock(mutex_) == EOWNERDEAD) {
+                ::pthread_mutex_consistent(mutex_);
+            }
+        }
+        ~Lock() {
+            ::pthread_mutex_unlock(mutex_);
+        }
+
+    private:
+        pthread_mutex_t* mutex_;
+    };
+
+    SharedSegment(void* base, size_t size, size_t slot)
+            : base_(static_cast<char*>(base)), size_(size), header_(static_cast<Header*>(base)), slot_(slot) {
+    }
+
+    static SharedPtr<SharedSegment> Initialize(void* base, size_t size) {
+        auto header = new (base) Header();
+        header->size = size;
+        header->bump = (sizeof(Header) + alignof(SegmentBlock) - 1) / alignof(SegmentBlock) * alignof(SegmentBlock);
+        pthread_mutexattr_t attributes;
+        ::pthread_mutexattr_init(&attributes);
+        ::pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        ::pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        ::pthread_mutex_init(&header->mutex, &attributes);
+        ::pthread_mutexattr_destroy(&attributes);
+        header->magic.store(kMagic, std::memory_order_release);
+        return Attach(base, size);
+    }
+
+    static SharedPtr<SharedSegment> Attach(void* base, size_t size) {
+        auto header = static_cast<Header*>(base);
+        for (size_t slot = 0; slot < kMaxProcesses; ++slot) {
+            pid_t expected = 0;
+            if (header->pids[slot].compare_exchange_strong(expected, kReserved)) {
+                header->start_times[slot].store(ProcessStartTime(::getpid()), std::memory_order_relaxed);
+                header->pids[slot].store(::getpid(), std::memory_order_release);
+                return SharedPtr<SharedSegment>(new SharedSegment(base, size, slot));
+            }
+        }
+        ::munmap(base, size);
+        errno = EAGAIN;
+        return nullptr;
+    }
+
+    // Field 22 of /proc/<pid>/stat, in clock ticks since boot; 0 if unavailable. Together with the
+    // pid it identifies a process even after the pid is reused.
+    static uint64_t ProcessStartTime(pid_t pid) {
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string line;
+        std::getline(stat, line);
+        // The command name in field 2 may contain spaces and parentheses, the fields after it not
+        size_t end = line.rfind(')');
+        if (end == std::string::npos) {
+            return 0;
+        }
+        std::istringstream fields(line.substr(end + 1));
+        std::string field;
+        for (int index = 3; index < 22 && fields >> field; ++index) {
+        }
+        uint64_t start_time = 0;
+        fields >> start_time;
+        return start_time;
+    }
+
+    static bool Alive(pid_t pid, uint64_t start_time) {
+        if (::kill(pid, 0) != 0 && errno == ESRCH) {
+            return false;
+        }
+        uint64_t current = ProcessStartTime(pid);
+        return start_time == 0 || current == 0 || current == start_time;
+    }
+
+    SegmentBlock* BlockAt(uint64_t offset) const {
+        assert(offset >= sizeof(Header) && offset < size_);
+        return reinterpret_cast<SegmentBlock*>(base_ + offset);
+    }
+    uint64_t OffsetOf(const SegmentBlock* block) const {
+        return reinterpret_cast<const char*>(block) - base_;
+    }
+
+    size_t FreeSlotLocked() {
+        for (size_t slot = 0; slot < kMaxProcesses; ++slot) {
+            pid_t expected = 0;
+            if (header_->pids[slot].compare_exchange_strong(expected, kReserved)) {
+                return slot;
+            }
+        }
+        return kMaxProcesses;
+    }
+
+    SegmentBlock* Allocate(size_t size) {
+        size_t size_class = 0;
+        while ((kMinBlockSize << size_class) < size) {
+            ++size_class;
+        }
+        size_t block_size = kMinBlockSize << size_class;
+
+        Lock lock(header_);
+        SegmentBlock* block;
+        if (header_->free_lists[size_class]) {
+            block = BlockAt(header_->free_lists[size_class]);
+            header_->free_lists[size_class] = block->next;
+            block->generation.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            if (header_->bump + block_size > size_) {
+                return nullptr;
+            }
+            block = new (base_ + header_->bump) SegmentBlock();
+            header_->bump += block_size;
+            block->size_class = static_cast<uint32_t>(size_class);
+        }
+        for (auto& count : block->counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+        block->strong.store(1, std::memory_order_relaxed);
+        block->counts[slot_].store(1, std::memory_order_relaxed);
+
+        block->prev = 0;
+        block->next = header_->blocks;
+        if (header_->blocks) {
+            BlockAt(header_->blocks)->prev = OffsetOf(block);
+        }
+        header_->blocks = OffsetOf(block);
+        ++header_->live_blocks;
+        return block;
+    }
+
+    void FreeLocked(SegmentBlock* block) {
+        if (block->prev) {
+            BlockAt(block->prev)->next = block->next;
+        } else {
+            header_->blocks = block->next;
+        }
+        if (block->next) {
+            BlockAt(block->next)->prev = block->prev;
+        }
+        block->next = header_->free_lists[block->size_class];
+        header_->free_lists[block->size_class] = OffsetOf(block);
+        --header_->live_blocks;
+    }
+
+    // Drops `count` references counted in `slot`; true if they were the last ones and the
+    // caller has claimed the block for freeing
+    static bool DropRefs(SegmentBlock* block, size_t slot, uint32_t count) {
+        uint32_t generation = block->generation.load(std::memory_order_acquire);
+        block->counts[slot].fetch_sub(count, std::memory_order_relaxed);
+        return block->strong.fetch_sub(count, std::memory_order_acq_rel) == count &&
+               block->generation.compare_exchange_strong(generation, generation + 1, std::memory_order_acq_rel);
+    }
+
+    void Release(SegmentBlock* block, size_t slot) {
+        if (DropRefs(block, slot, 1)) {
+            Lock lock(header_);
+            FreeLocked(block);
+        }
+    }
+
+    // Subtracts one slot's references (kMaxProcesses just collects orphans: blocks whose last
+    // releaser died before freeing them) and frees what nobody references any more
+    void ReapSlotLocked(size_t slot) {
+        for (uint64_t offset = header_->blocks; offset;) {
+            SegmentBlock* block = BlockAt(offset);
+            offset = block->next;
+            uint32_t count = slot < kMaxProcesses ? block->counts[slot].load(std::memory_order_relaxed) : 0;
+            bool claimed;
+            if (count > 0) {
+                claimed = DropRefs(block, slot, count);
+            } else {
+                uint32_t generation = block->generation.load(std::memory_order_acquire);
+                claimed = generation % 2 == 0 && block->strong.load(std::memory_order_acquire) == 0 &&
+                          block->generation.compare_exchange_strong(generation, generation + 1,
+                                                                    std::memory_order_acq_rel);
+            }
+            if (claimed) {
+                FreeLocked(block);
+            }
+        }
+        if (slot < kMaxProcesses) {
+            header_->start_times[slot].store(0, std::memory_order_relaxed);
+            header_->pids[slot].store(0, std::memory_order_release);
+        }
+    }
+
+    char* base_;
+    size_t size_;
+    Header* header_;
+    size_t slot_;
+};
+
+// Reference to an object in a SharedSegment, counted in this process' slot of the block.
+// Lives in process memory and must not outlive its segment; to hand the object to another
+// process, pass Offset() and Acquire it there, or use the segment's roots.
+template <typename T>
+class InterprocessSharedPtr {
+public:
+    InterprocessSharedPtr() = default;
+
+    InterprocessSharedPtr(const InterprocessSharedPtr& other) : segment_(other.segment_), block_(other.block_) {
+        if (block_) {
+            block_->AddRef(segment_->slot_);
+        }
+    }
+    InterprocessSharedPtr(InterprocessSharedPtr&& other)
+            : segment_(std::exchange(other.segment_, nullptr)), block_(std::exchange(other.block_, nullptr)) {
+    }
+    InterprocessSharedPtr& operator=(InterprocessSharedPtr other) {
+        std::swap(segment_, other.segment_);
+        std::swap(block_, other.block_);
+        return *this;
+    }
+
+    ~InterprocessSharedPtr() {
+        Reset();
+    }
+
+    void Reset() {
+        if (block_) {
+            segment_->Release(block_, segment_->slot_);
+        }
+        segment_ = nullptr;
+        block_ = nullptr;
+    }
+
+    T* Get() const {
+        return block_ ? static_cast<T*>(block_->Object()) : nullptr;
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+
+    // References from all processes and the root table
+    size_t UseCount() const {
+        return block_ ? block_->UseCount() : 0;
+    }
+    // Position of the object in the segment, the same in every process
+    uint64_t Offset() const {
+        return block_ ? segment_->OffsetOf(block_) : 0;
+    }
+
+private:
+    friend class SharedSegment;
+
+    InterprocessSharedPtr(SharedSegment* segment, SegmentBlock* block) : segment_(segment), block_(block) {
+    }
+
+    SharedSegment* segment_ = nullptr;
+    SegmentBlock* block_ = nullptr;
+};
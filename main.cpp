@@ -2,7 +2,33 @@
 #include "allocations_checker.h"
 #include <memory>
 #include <cassert>
+#include <thread>
+#include <vector>
 #include "shared.h"
+#include "concurrent_map.h"
+#include "shared_ptr_set.h"
+#include "interner.h"
+#include "shared_cache.h"
+#include "memory_pressure.h"
+#include "synchronized.h"
+#include "seq_value.h"
+#include "versioned.h"
+#include "future.h"
+#include "shared_function.h"
+#include "block_pool.h"
+#include "task.h"
+#include "buffer.h"
+#include "mapped_file.h"
+#include "fork.h"
+#include "interprocess.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include <filesystem>
+#include <fstream>
+#include <array>
+#include <map>
+#include <unordered_set>
+#include <sys/wait.h>
 
 struct A {
     ~A() = default;
@@ -138,6 +164,54 @@ struct ModifiersC {
 
 int ModifiersC::count = 0;
 
+struct ManualEvent {
+    std::coroutine_handle<> waiter;
+
+    bool await_ready() {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+        waiter = handle;
+    }
+    void await_resume() {
+    }
+};
+
+SharedTask<int> WaitForEvent(ManualEvent& event, int value) {
+    co_await event;
+    co_return value;
+}
+
+SharedTask<int> Doubled(SharedTask<int> task) {
+    int value = co_await task;
+    co_return value * 2;
+}
+
+SharedTask<ModifiersC> MakeModifiersC() {
+    co_return ModifiersC();
+}
+
+struct GraphNode {
+    int value = 0;
+    std::string name;
+    std::vector<SharedPtr<GraphNode>> edges;
+    WeakPtr<GraphNode> parent;
+};
+
+void Serialize(GraphWriter& writer, const GraphNode& node) {
+    writer.Write(node.value);
+    writer.Write(node.name);
+    writer.Write(node.edges);
+    writer.Write(node.parent);
+}
+
+void Deserialize(GraphReader& reader, GraphNode& node) {
+    reader.Read(node.value);
+    reader.Read(node.name);
+    reader.Read(node.edges);
+    reader.Read(node.parent);
+}
+
 int main() {
     std::cout << "================ TEST 1: EMPTY STATE ================" << '\n';
     {
@@ -469,4 +543,1188 @@ int main() {
         assert(B::destructor_called);
     }
     std::cout << "++++++++++++++++ TEST 20 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 21: CONCURRENT MAP ================" << '\n';
+    {
+        {
+            ConcurrentSharedMap<int, ModifiersC> map(4, 2);
+            for (int i = 0; i < 1000; ++i) {
+                assert(map.Insert(i, MakeShared<ModifiersC>()));
+            }
+            assert(!map.Insert(0, MakeShared<ModifiersC>()));
+            assert(map.Size() == 1000);
+
+            auto value = map.Find(7);
+            assert(value && value.UseCount() == 2);
+            assert(map.InsertOrAssign(7, MakeShared<ModifiersC>()).Get() == value.Get());
+            assert(map.Find(7).Get() != value.Get());
+            for (int i = 0; i < 1000; i += 2) {
+                assert(map.Erase(i));
+            }
+            assert(!map.Erase(0));
+            assert(!map.Find(0));
+            assert(map.Find(1));
+            assert(map.Size() == 500);
+        }
+        EpochDomain::Global().Drain();
+        assert(ModifiersC::count == 0);
+
+        {
+            ConcurrentSharedMap<int, int> map(2, 2);
+            std::vector<std::thread> readers;
+            std::atomic<bool> stop{false};
+            for (int t = 0; t < 3; ++t) {
+                readers.emplace_back([&map, &stop] {
+                    while (!stop.load()) {
+                        for (int key = 0; key < 256; ++key) {
+                            auto value = map.Find(key);
+                            assert(!value || *value % 256 == key);
+                        }
+                    }
+                });
+            }
+            for (int round = 0; round < 200; ++round) {
+                for (int key = 0; key < 256; ++key) {
+                    if ((key + round) % 3 == 0) {
+                        map.Erase(key);
+                    } else {
+                        map.InsertOrAssign(key, MakeShared<int>(key + 256 * round));
+                    }
+                }
+            }
+            stop.store(true);
+            for (auto& reader : readers) {
+                reader.join();
+            }
+        }
+        EpochDomain::Global().Drain();
+
+        // Values whose destructor writes to the same shard: deleters must not run under its lock
+        {
+            struct Reentrant {
+                ConcurrentSharedMap<int, Reentrant>* map = nullptr;
+                int* reentered = nullptr;
+                ~Reentrant() {
+                    if (map) {
+                        ++*reentered;
+                        map->InsertOrAssign(-1, MakeShared<Reentrant>());
+                    }
+                }
+            };
+            int reentered = 0;
+            ConcurrentSharedMap<int, Reentrant> map(1, 2);
+            for (int round = 0; round < 1000; ++round) {
+                map.InsertOrAssign(0, MakeShared<Reentrant>(&map, &reentered));
+            }
+            assert(reentered > 0);
+            map.Erase(0);
+            EpochDomain::Global().Drain();
+        }
+
+        // More threads pinned at once than there are epoch slots
+        {
+            constexpr size_t kThreads = EpochDomain::kMaxThreads + 44;
+            static int freed;
+            freed = 0;
+            std::atomic<size_t> pinned{0};
+            std::atomic<bool> release{false};
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < kThreads; ++i) {
+                threads.emplace_back([&] {
+                    EpochDomain::Guard guard;
+                    pinned.fetch_add(1);
+                    while (!release.load()) {
+                        std::this_thread::yield();
+                    }
+                });
+            }
+            while (pinned.load() < kThreads) {
+                std::this_thread::yield();
+            }
+            EpochDomain::Global().Retire(&freed, [](void*) { ++freed; });
+            for (int i = 0; i < 4; ++i) {
+                EpochDomain::Global().Collect();
+            }
+            assert(freed == 0);
+            release.store(true);
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            EpochDomain::Global().Drain();
+            assert(freed == 1);
+        }
+    }
+    std::cout << "++++++++++++++++ TEST 21 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 22: COMPARISON AND HASHING ================" << '\n';
+    {
+        SharedPtr<Data> sp(new Data{42, 3.14});
+        SharedPtr<Data> copy = sp;
+        SharedPtr<double> alias(sp, &sp->y);
+        SharedPtr<Data> other(new Data{1, 2.0});
+        SharedPtr<Data> empty;
+
+        assert(sp == copy);
+        assert(sp != other);
+        assert(empty == nullptr);
+        assert(sp != nullptr);
+        assert((sp < other) != (other < sp));
+        assert((sp <=> copy) == 0);
+
+        assert(!sp.OwnerBefore(alias) && !alias.OwnerBefore(sp));
+        assert(sp.OwnerHash() == copy.OwnerHash());
+
+        std::unordered_set<SharedPtr<Data>> set{sp, copy, other};
+        assert(set.size() == 2);
+        std::map<SharedPtr<double>, int, OwnerLess> owners;
+        owners[alias] = 1;
+        owners[SharedPtr<double>(sp, &sp->y)] = 2;
+        assert(owners.size() == 1);
+    }
+    std::cout << "++++++++++++++++ TEST 22 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 23: SHARED PTR SET/MAP ================" << '\n';
+    {
+        {
+            std::vector<SharedPtr<ModifiersC>> values;
+            SharedPtrSet<ModifiersC> set(2);
+            SharedPtrMap<ModifiersC, int> map;
+            for (int i = 0; i < 1000; ++i) {
+                values.push_back(MakeShared<ModifiersC>());
+                assert(set.Insert(values.back()));
+                map[values.back()] = i;
+            }
+            assert(!set.Insert(values[0]));
+            assert(!set.Insert(SharedPtr<ModifiersC>()));
+            bool thrown = false;
+            try {
+                map[SharedPtr<ModifiersC>()] = -1;
+            } catch (const std::invalid_argument&) {
+                thrown = true;
+            }
+            assert(thrown && !map.Find(nullptr));
+            assert(set.Size() == 1000 && map.Size() == 1000);
+            assert(values[0].UseCount() == 3);
+
+            for (int i = 0; i < 1000; i += 2) {
+                assert(set.Erase(values[i]));
+                assert(map.Erase(values[i].Get()));
+            }
+            assert(!set.Erase(values[0]));
+            for (int i = 0; i < 1000; ++i) {
+                assert(set.Contains(values[i]) == (i % 2 == 1));
+                assert((map.Find(values[i]) != nullptr) == (i % 2 == 1));
+                assert(i % 2 == 0 || *map.Find(values[i]) == i);
+            }
+            assert(values[0].UseCount() == 1);
+            assert(values[1].UseCount() == 3);
+
+            size_t visited = 0;
+            set.ForEach([&visited](const SharedPtr<ModifiersC>&) { ++visited; });
+            assert(visited == 500);
+            values.clear();
+            assert(ModifiersC::count == 500);
+        }
+        assert(ModifiersC::count == 0);
+    }
+    std::cout << "++++++++++++++++ TEST 23 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 24: WEAK PTR ================" << '\n';
+    {
+        WeakPtr<ModifiersC> weak;
+        assert(weak.Expired());
+        assert(!weak.Lock());
+        {
+            auto sp = MakeShared<ModifiersC>();
+            weak = sp;
+            WeakPtr<const ModifiersC> copy(weak);
+            assert(!weak.Expired());
+            assert(weak.UseCount() == 1);
+            assert(copy.Lock().Get() == sp.Get());
+            assert(sp.UseCount() == 1);
+        }
+        assert(ModifiersC::count == 0);
+        assert(weak.Expired());
+        assert(!weak.Lock());
+
+        EXPECT_ZERO_ALLOCATIONS(weak.Reset());
+    }
+    std::cout << "++++++++++++++++ TEST 24 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 25: INTERNER ================" << '\n';
+    {
+        Interner<std::string> interner(4);
+        {
+            auto a = interner.Intern("hello");
+            auto b = interner.Intern(std::string("hello"));
+            auto c = interner.Intern("world");
+            assert(a == b);
+            assert(a != c);
+            assert(*a == "hello");
+            assert(a.UseCount() == 2);
+            assert(interner.Size() == 2);
+        }
+        assert(interner.Size() == 0);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&interner] {
+                for (int i = 0; i < 2000; ++i) {
+                    auto first = interner.Intern(std::to_string(i % 50));
+                    auto second = interner.Intern(std::to_string(i % 50));
+                    assert(first == second);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(interner.Size() == 0);
+
+        // Interned values may outlive the interner
+        SharedPtr<const std::string> survivor;
+        {
+            Interner<std::string> scoped;
+            survivor = scoped.Intern("survivor");
+        }
+        assert(*survivor == "survivor");
+    }
+    std::cout << "++++++++++++++++ TEST 25 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 26: SHARED CACHE ================" << '\n';
+    {
+        {
+            SharedCache<int, ModifiersC> cache(4, SharedCache<int, ModifiersC>::Clock::duration::zero(), 1);
+            auto held = MakeShared<ModifiersC>();
+            cache.Put(0, MakeShared<ModifiersC>());
+            cache.Put(1, held);
+            cache.Put(2, MakeShared<ModifiersC>());
+            cache.Put(3, MakeShared<ModifiersC>());
+            assert(cache.Get(0));
+            assert(cache.Size() == 4);
+
+            // The clock hand skips the referenced entry 0 and evicts entry 1
+            cache.Put(4, MakeShared<ModifiersC>());
+            assert(cache.Size() == 4);
+            auto stats = cache.GetStats();
+            assert(stats.hits == 1 && stats.evictions == 1);
+
+            // The evicted value is still held here, so it comes back through the weak reference
+            assert(cache.Get(1) == held);
+            assert(cache.GetStats().resurrections == 1);
+            assert(!cache.Get(100));
+            assert(cache.GetStats().misses == 1);
+
+            assert(cache.Erase(4));
+            assert(!cache.Get(4));
+            assert(ModifiersC::count <= 5);
+        }
+        EpochDomain::Global().Drain();
+        assert(ModifiersC::count == 0);
+
+        {
+            SharedCache<int, int> cache(16, std::chrono::milliseconds(1));
+            cache.Put(1, MakeShared<int>(1));
+            assert(*cache.Get(1) == 1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            assert(!cache.Get(1));
+            assert(*cache.GetOrCreate(1, [] { return MakeShared<int>(2); }) == 2);
+        }
+        {
+            // Eviction keeps the ring in insertion order: 2 and 3 go, then 1 after its second
+            // chance, while the newer 4 and 5 stay
+            SharedCache<int, int> cache(3, SharedCache<int, int>::Clock::duration::zero(), 1);
+            for (int i = 1; i <= 3; ++i) {
+                cache.Put(i, MakeShared<int>(i));
+            }
+            assert(cache.Get(1));
+            cache.Put(4, MakeShared<int>(4));
+            cache.Put(5, MakeShared<int>(5));
+            cache.Put(6, MakeShared<int>(6));
+            assert(!cache.Get(1) && !cache.Get(2) && !cache.Get(3));
+            assert(cache.Get(4) && cache.Get(5) && cache.Get(6));
+        }
+        EpochDomain::Global().Drain();
+    }
+    std::cout << "++++++++++++++++ TEST 26 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 27: MEMORY PRESSURE MONITOR ================" << '\n';
+    {
+        namespace fs = std::filesystem;
+        char root_template[] = "/tmp/my_shared_ptr_fakefs_XXXXXX";
+        fs::path root = mkdtemp(root_template);
+        fs::create_directories(root / "proc/self");
+        fs::create_directories(root / "proc/pressure");
+        fs::create_directories(root / "cgroup/app");
+        auto write = [](const fs::path& path, const std::string& content) {
+            std::ofstream(path) << content;
+        };
+        write(root / "proc/self/cgroup", "0::/app\n");
+        write(root / "cgroup/app/memory.max", "1000\n");
+        write(root / "cgroup/app/memory.current", "100\n");
+        write(root / "cgroup/app/memory.events", "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0\n");
+        write(root / "proc/pressure/memory",
+              "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+              "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+
+        MemoryPressureMonitor::Options options;
+        options.proc_root = (root / "proc").string();
+        options.cgroup_root = (root / "cgroup").string();
+        MemoryPressureMonitor monitor(options);
+
+        {
+            SharedCache<int, ModifiersC> cache(64);
+            auto held = MakeShared<ModifiersC>();
+            cache.Put(0, held);
+            for (int i = 1; i < 9; ++i) {
+                cache.Put(i, MakeShared<ModifiersC>());
+            }
+            size_t id = monitor.Register(cache);
+
+            assert(monitor.Poll() == PressureLevel::kNone);
+            assert(cache.Size() == 9);
+
+            // A new memory.high event is moderate pressure: half of the cache-only entries go
+            write(root / "cgroup/app/memory.events", "low 0\nhigh 1\nmax 0\noom 0\noom_kill 0\n");
+            assert(monitor.Poll() == PressureLevel::kModerate);
+            assert(cache.Size() == 5);
+            assert(monitor.Poll() == PressureLevel::kNone);
+
+            // Near the limit everything that only the cache holds is dropped
+            write(root / "cgroup/app/memory.current", "990\n");
+            assert(monitor.Poll() == PressureLevel::kCritical);
+            assert(cache.Size() == 1);
+            assert(cache.Get(0) == held);
+            assert(monitor.ShedCount() == 8);
+
+            write(root / "cgroup/app/memory.current", "100\n");
+            write(root / "proc/pressure/memory",
+                  "some avg10=25.00 avg60=0.00 avg300=0.00 total=0\n"
+                  "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+            assert(monitor.Poll() == PressureLevel::kModerate);
+            monitor.Unregister(id);
+        }
+        EpochDomain::Global().Drain();
+        assert(ModifiersC::count == 0);
+        fs::remove_all(root);
+    }
+    std::cout << "++++++++++++++++ TEST 27 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 28: SHARED SYNCHRONIZED ================" << '\n';
+    {
+        auto check = [](auto synchronized) {
+            auto copy = synchronized;
+            assert(copy.UseCount() == 2);
+
+            std::vector<std::thread> threads;
+            for (int t = 0; t < 4; ++t) {
+                threads.emplace_back([copy] {
+                    for (int i = 0; i < 1000; ++i) {
+                        copy.WithWLock([](std::pair<int, int>& value) {
+                            ++value.first;
+                            ++value.second;
+                        });
+                        bool consistent = copy.WithRLock(
+                                [](const std::pair<int, int>& value) { return value.first == value.second; });
+                        assert(consistent);
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            assert(synchronized.WithRLock([](const std::pair<int, int>& value) { return value.first; }) ==
+                   4000);
+        };
+
+        EXPECT_ONE_ALLOCATION(auto synchronized = (MakeSharedSynchronized<std::pair<int, int>>(0, 0)));
+        check(MakeSharedSynchronized<std::pair<int, int>>(0, 0));
+        check(MakeSharedSynchronized<std::pair<int, int>, SpinRWLock>(0, 0));
+        check(MakeSharedSynchronized<std::pair<int, int>, PerCoreRWLock>(0, 0));
+    }
+    std::cout << "++++++++++++++++ TEST 28 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 29: SHARED SEQ VALUE ================" << '\n';
+    {
+        struct Quote {
+            int64_t bid;
+            int64_t ask;
+            int64_t bid_size;
+            int64_t ask_size;
+        };
+
+        auto quote = MakeSharedSeqValue<Quote>(Quote{1, 1, 1, 1});
+        assert(quote.Load().ask == 1);
+        assert(quote.Version() == 0);
+
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 3; ++t) {
+            readers.emplace_back([quote, &stop] {
+                while (!stop.load()) {
+                    Quote snapshot = quote.Load();
+                    assert(snapshot.bid == snapshot.ask && snapshot.ask == snapshot.bid_size &&
+                           snapshot.bid_size == snapshot.ask_size);
+                }
+            });
+        }
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 2; ++t) {
+            writers.emplace_back([quote] {
+                for (int i = 0; i < 10000; ++i) {
+                    quote.Update([](Quote& value) {
+                        ++value.bid;
+                        ++value.ask;
+                        ++value.bid_size;
+                        ++value.ask_size;
+                    });
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        stop.store(true);
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        assert(quote.Load().bid == 20001);
+        assert(quote.Version() == 20000);
+        quote.Store(Quote{7, 7, 7, 7});
+        assert(quote.Load().ask_size == 7);
+    }
+    std::cout << "++++++++++++++++ TEST 29 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 30: VERSIONED SHARED ================" << '\n';
+    {
+        {
+            VersionedShared<int> cell(MakeShared<int>(0));
+            auto first = cell.TakeSnapshot();
+            assert(cell.Commit(MakeShared<int>(1)) == 1);
+            auto second = cell.TakeSnapshot();
+            cell.Commit(MakeShared<int>(2));
+            cell.Commit(MakeShared<int>(3));
+
+            assert(*cell.Read(first) == 0);
+            assert(*cell.Read(second) == 1);
+            assert(*cell.ReadLatest() == 3);
+            assert(cell.VersionCount() == 4);
+
+            { auto moved = std::move(first); }
+            cell.Commit(MakeShared<int>(4));
+            assert(cell.VersionCount() == 4);
+            assert(*cell.Read(second) == 1);
+        }
+        {
+            VersionedShared<std::pair<int, int>> cell(MakeShared<std::pair<int, int>>(0, 0));
+            std::atomic<bool> stop{false};
+            std::vector<std::thread> readers;
+            for (int t = 0; t < 3; ++t) {
+                readers.emplace_back([&cell, &stop] {
+                    while (!stop.load()) {
+                        auto snapshot = cell.TakeSnapshot();
+                        auto a = cell.Read(snapshot);
+                        auto b = cell.Read(snapshot);
+                        assert(a == b);
+                        assert(a->first == a->second && static_cast<uint64_t>(a->first) <= snapshot.Timestamp());
+                    }
+                });
+            }
+            for (int i = 1; i <= 5000; ++i) {
+                cell.Commit(MakeShared<std::pair<int, int>>(i, i));
+            }
+            stop.store(true);
+            for (auto& reader : readers) {
+                reader.join();
+            }
+            // Unused versions are pruned by the next commit
+            cell.Commit(MakeShared<std::pair<int, int>>(0, 0));
+            assert(cell.VersionCount() == 1);
+        }
+        EpochDomain::Global().Drain();
+    }
+    std::cout << "++++++++++++++++ TEST 30 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 31: WAIT UNTIL UNIQUE / ON LAST RELEASE ================" << '\n';
+    {
+        auto sp = MakeShared<int>(5);
+        std::vector<size_t> released;
+        std::mutex released_mutex;
+        sp.OnLastRelease([&released, &released_mutex](size_t remaining) {
+            std::lock_guard lock(released_mutex);
+            released.push_back(remaining);
+        });
+
+        std::vector<std::thread> users;
+        for (int t = 0; t < 4; ++t) {
+            users.emplace_back([copy = sp]() mutable {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                copy.Reset();
+            });
+        }
+        sp.WaitUntilUnique();
+        assert(sp.UseCount() == 1);
+        for (auto& user : users) {
+            user.join();
+        }
+        assert(released == std::vector<size_t>{1});
+
+        sp.Reset();
+        assert((released == std::vector<size_t>{1, 0}));
+
+        // Unobserved pointers never reach the observers table
+        auto quiet = MakeShared<int>(1);
+        EXPECT_ZERO_ALLOCATIONS(quiet.Reset());
+        SharedPtr<int>().WaitUntilUnique();
+
+        // Subscribing races with the last-but-one release: a hook registered before it is told
+        for (int round = 0; round < 2000; ++round) {
+            auto held = MakeShared<int>(round);
+            auto other = held;
+            std::vector<size_t> seen;
+            std::atomic<bool> subscribed{false};
+            std::thread subscriber([&] {
+                held.OnLastRelease([&seen](size_t remaining) { seen.push_back(remaining); });
+                subscribed.store(true);
+            });
+            bool subscribed_before = subscribed.load();
+            other.Reset();
+            subscriber.join();
+            held.Reset();
+            assert(seen.size() <= 2 && seen.back() == 0);
+            assert(!subscribed_before || (seen == std::vector<size_t>{1, 0}));
+        }
+    }
+    std::cout << "++++++++++++++++ TEST 31 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 32: SHARED PROMISE/FUTURE ================" << '\n';
+    {
+        {
+            int seen = 0;
+            EXPECT_ONE_ALLOCATION({
+                SharedPromise<int> promise;
+                auto future = promise.GetFuture();
+                future.Then([&seen](const int& value) { seen = value; });
+                assert(!future.IsReady());
+                promise.SetValue(42);
+                assert(future.IsReady() && future.Get() == 42);
+            });
+            assert(seen == 42);
+        }
+        {
+            SharedPromise<std::string> promise;
+            auto future = promise.GetFuture();
+            promise.SetValue("ready");
+            std::string seen;
+            future.Then([&seen](const std::string& value) { seen = value; });
+            assert(seen == "ready");
+        }
+        {
+            // A capture larger than the inline buffer still works
+            std::array<int64_t, 16> big{};
+            big[15] = 7;
+            int64_t seen = 0;
+            SharedPromise<int> promise;
+            promise.GetFuture().Then([big, &seen](const int& value) { seen = big[15] + value; });
+            promise.SetValue(1);
+            assert(seen == 8);
+        }
+        {
+            SharedPromise<int> ping;
+            SharedPromise<int> pong;
+            std::thread other([future = ping.GetFuture(), pong]() mutable { pong.SetValue(future.Get() + 1); });
+            ping.SetValue(1);
+            assert(pong.GetFuture().Get() == 2);
+            other.join();
+        }
+    }
+    std::cout << "++++++++++++++++ TEST 32 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 33: SHARED FUNCTION ================" << '\n';
+    {
+        std::array<int64_t, 32> big{};
+        big[0] = 10;
+        int calls = 0;
+
+        SharedFunction<int64_t(int64_t)> f;
+        assert(!f);
+        bool thrown = false;
+        try {
+            f(1);
+        } catch (const std::bad_function_call&) {
+            thrown = true;
+        }
+        assert(thrown);
+        EXPECT_ONE_ALLOCATION(f = MakeSharedFunction<int64_t(int64_t)>([big, &calls](int64_t x) {
+                                  ++calls;
+                                  return big[0] + x;
+                              }));
+        SharedFunction<int64_t(int64_t)> copy;
+        EXPECT_ZERO_ALLOCATIONS(copy = f);
+        assert(f.UseCount() == 2);
+        assert(f(1) == 11);
+        assert(copy(2) == 12);
+        assert(calls == 2);
+
+        // The captured state is shared between copies
+        SharedFunction<int()> counter = [n = 0]() mutable { return ++n; };
+        auto counter_copy = counter;
+        assert(counter() == 1);
+        assert(counter_copy() == 2);
+        auto moved = std::move(counter_copy);
+        assert(moved() == 3 && !counter_copy);
+
+        {
+            SharedFunction<void()> holder = [c = ModifiersC()] {};
+            assert(ModifiersC::count == 1);
+        }
+        assert(ModifiersC::count == 0);
+    }
+    std::cout << "++++++++++++++++ TEST 33 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 34: MAKE_SHARED_POOLED ================" << '\n';
+    {
+        {
+            std::vector<SharedPtr<ModifiersC>> values;
+            for (int i = 0; i < 1000; ++i) {
+                values.push_back(MakeSharedPooled<ModifiersC>());
+            }
+            SharedPtr<ModifiersC> copy = values[0];
+            assert(copy.UseCount() == 2);
+
+            std::thread other([values = std::move(values)]() mutable { values.clear(); });
+            other.join();
+            assert(ModifiersC::count == 1);
+
+            // Blocks freed on the other thread went back to the central lists and are reused
+            auto reused = MakeSharedPooled<ModifiersC>();
+            assert(ModifiersC::count == 2);
+        }
+        assert(ModifiersC::count == 0);
+
+        B::destructor_called = false;
+        { SharedPtr<A> ptr = MakeSharedPooled<B>(); }
+        assert(B::destructor_called);
+
+        // Thread-exit destructors running after the thread's pool cache is gone
+        std::thread([] {
+            struct Holder {
+                SharedPtr<ModifiersC> ptr;
+                ~Holder() {
+                    auto other = MakeSharedPooled<ModifiersC>();
+                    assert(ModifiersC::count == 2);
+                }
+            };
+            static thread_local Holder holder;
+            holder.ptr = MakeSharedPooled<ModifiersC>();
+        }).join();
+        assert(ModifiersC::count == 0);
+    }
+    std::cout << "++++++++++++++++ TEST 34 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 35: SHARED TASK ================" << '\n';
+    {
+        {
+            ManualEvent event;
+            auto task = WaitForEvent(event, 21);
+            auto first = Doubled(task);
+            auto second = Doubled(task);
+            assert(!task.IsReady() && !first.IsReady());
+            // The handle, the parameters of both awaiters and the running coroutine itself
+            assert(task.UseCount() == 4);
+
+            event.waiter.resume();
+            assert(task.IsReady() && task.Get() == 21);
+            assert(first.Get() == 42 && second.Get() == 42);
+            assert(task.UseCount() == 3);
+            assert(Doubled(task).Get() == 42);
+        }
+        {
+            auto task = MakeModifiersC();
+            auto copy = task;
+            assert(ModifiersC::count == 1);
+            task = SharedTask<ModifiersC>();
+            assert(ModifiersC::count == 1);
+        }
+        assert(ModifiersC::count == 0);
+    }
+    std::cout << "++++++++++++++++ TEST 35 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 36: SHARED BUFFER / BUFFER CHAIN ================" << '\n';
+    {
+        SharedBuffer buffer;
+        EXPECT_ONE_ALLOCATION(buffer = SharedBuffer::Copy("header:payload;"));
+        SharedBuffer header, payload;
+        EXPECT_ZERO_ALLOCATIONS({
+            header = buffer.Slice(0, 7);
+            payload = buffer.Slice(7);
+        });
+        assert(header.View() == "header:");
+        assert(payload.View() == "payload;");
+        assert(buffer.UseCount() == 3);
+        assert(payload.Slice(0, 7).View() == "payload");
+
+        int fds[2];
+        assert(pipe(fds) == 0);
+        BufferChain chain;
+        chain.Append(payload);
+        chain.Append(header);
+        chain.Append(SharedBuffer());
+        assert(chain.Size() == 15);
+        iovec iov[4];
+        assert(chain.FillIovec(iov, 4) == 2);
+        assert(iov[0].iov_base == payload.Data());
+
+        chain.Consume(3);
+        assert(chain.Size() == 12);
+        assert(chain.WriteAllTo(fds[1]));
+        assert(chain.Empty());
+        close(fds[1]);
+
+        auto received = SharedBuffer::ReadFrom(fds[0], 64);
+        assert(received.View() == "load;header:");
+        assert(SharedBuffer::ReadFrom(fds[0], 64).Empty());
+        close(fds[0]);
+    }
+    std::cout << "++++++++++++++++ TEST 36 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 37: MAP SHARED / ARRAYS ================" << '\n';
+    {
+        SharedPtr<int[]> array(new int[4]{1, 2, 3, 4});
+        array[2] = 30;
+        SharedPtr<const int[]> readonly = array;
+        assert(readonly[2] == 30);
+        assert(array.UseCount() == 2);
+
+        char path_template[] = "/tmp/my_shared_ptr_mapped_XXXXXX";
+        int fd = mkstemp(path_template);
+        assert(fd >= 0);
+        std::vector<uint32_t> values(4096);
+        for (size_t i = 0; i < values.size(); ++i) {
+            values[i] = static_cast<uint32_t>(i * 7);
+        }
+        assert(write(fd, values.data(), values.size() * sizeof(uint32_t)) ==
+               static_cast<ssize_t>(values.size() * sizeof(uint32_t)));
+        close(fd);
+
+        size_t size = 0;
+        auto mapping = MapShared(path_template, MapFlags::kSequential | MapFlags::kWillNeed, &size);
+        assert(mapping);
+        assert(size == values.size() * sizeof(uint32_t));
+        assert(mapping[4] == std::byte{7});
+
+        SharedPtr<const uint32_t[]> tail;
+        EXPECT_ZERO_ALLOCATIONS(tail = SliceAs<uint32_t>(mapping, 1024 * sizeof(uint32_t)));
+        assert(mapping.UseCount() == 2);
+        mapping.Reset();
+        assert(tail[0] == 1024 * 7);
+        assert(tail[3071] == 4095 * 7);
+
+        auto again = MapShared(path_template, MapFlags::kHugePage | MapFlags::kPopulate);
+        assert(SliceAs<uint32_t>(again, 0)[100] == 700);
+
+        std::ofstream(path_template, std::ios::trunc);
+        assert(!MapShared(path_template, MapFlags::kNone, &size));
+        assert(size == 0);
+        unlink(path_template);
+        assert(!MapShared(path_template));
+        assert(errno == ENOENT);
+    }
+    std::cout << "++++++++++++++++ TEST 37 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 38: LARGE OBJECTS / MAKE_SHARED ARRAYS ================" << '\n';
+    {
+        struct Big {
+            char bytes[2 << 20];
+        };
+        struct Medium {
+            char bytes[128 << 10];
+        };
+
+        SharedPtr<Big> big;
+        EXPECT_ZERO_ALLOCATIONS(big = MakeShared<Big>());
+        assert(big->bytes[12345] == 0);
+        big->bytes[(2 << 20) - 1] = 1;
+        auto page = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(big.Get()) & ~uintptr_t{4095});
+        unsigned char residency;
+        assert(mincore(page, 4096, &residency) == 0);
+        big.Reset();
+        assert(mincore(page, 4096, &residency) == -1 && errno == ENOMEM);
+
+        SharedPtr<Medium> medium;
+        EXPECT_ONE_ALLOCATION(medium = MakeShared<Medium>());
+        LargeObjects::SetThreshold(64 << 10);
+        LargeObjects::SetHugePages(true);
+        EXPECT_ZERO_ALLOCATIONS(medium = MakeShared<Medium>());
+        LargeObjects::SetHugePages(false);
+        LargeObjects::SetThreshold(1 << 20);
+
+        SharedPtr<int[]> ints;
+        EXPECT_ONE_ALLOCATION(ints = MakeShared<int[]>(5));
+        assert(ints[0] == 0 && ints[4] == 0);
+        SharedPtr<double[]> doubles;
+        EXPECT_ZERO_ALLOCATIONS(doubles = MakeShared<double[]>(1 << 18));
+        doubles[(1 << 18) - 1] = 2.5;
+        assert(doubles[(1 << 18) - 1] == 2.5);
+
+        bool thrown = false;
+        try {
+            MakeShared<uint64_t[]>(SIZE_MAX / 4);
+        } catch (const std::bad_array_new_length&) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        static int constructed, destroyed;
+        struct Fragile {
+            Fragile() {
+                if (constructed == 3) {
+                    throw std::runtime_error("fragile");
+                }
+                ++constructed;
+            }
+            ~Fragile() {
+                ++destroyed;
+            }
+        };
+        thrown = false;
+        try {
+            MakeShared<Fragile[]>(5);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown && constructed == 3 && destroyed == 3);
+
+        auto strings = MakeShared<std::string[]>(3);
+        strings[2] = std::string(100, 'x');
+        WeakPtr<std::string[]> weak = strings;
+        strings.Reset();
+        assert(weak.Expired());
+    }
+    std::cout << "++++++++++++++++ TEST 38 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 39: HUGE PAGE BLOCK POOL ================" << '\n';
+    {
+        struct Node {
+            char payload[200];
+        };
+        BlockPool::EnableHugePages(true);
+        auto before = BlockPool::GetStats();
+        std::vector<SharedPtr<Node>> nodes;
+        for (size_t i = 0; i < 1000; ++i) {
+            nodes.push_back(MakeSharedPooled<Node>());
+        }
+        auto after = BlockPool::GetStats();
+        BlockPool::DisableHugePages();
+
+        assert(after.chunks > before.chunks);
+        assert(after.regions == before.regions + 1);
+        assert(after.huge_regions <= after.regions && after.locked_regions <= after.regions);
+        // Chunks carved from the region after the first one sit in the same 2 MiB page
+        auto region = reinterpret_cast<uintptr_t>(nodes.back().Get()) & ~(BlockPool::kHugePageSize - 1);
+        assert(reinterpret_cast<uintptr_t>(nodes[900].Get()) - region < BlockPool::kHugePageSize);
+        nodes.clear();
+    }
+    std::cout << "++++++++++++++++ TEST 39 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 40: FREEZE FOR FORK ================" << '\n';
+    {
+        struct Row {
+            char data[4000];
+        };
+        // Frozen objects are never freed, so the table is intentionally leaked as well
+        static auto& frozen = *new std::vector<SharedPtr<Row>>;
+        std::vector<SharedPtr<Row>> counted;
+        std::map<int, SharedPtr<Row>> index;
+        for (int i = 0; i < 1024; ++i) {
+            frozen.push_back(MakeShared<Row>());
+            counted.push_back(MakeShared<Row>());
+        }
+        index[0] = frozen[0];
+        FreezeForFork(frozen, index);
+        assert(frozen[1].IsImmortal() && !counted[1].IsImmortal());
+        assert(frozen[1].UseCount() == 1);
+        {
+            auto copy = frozen[1];
+            WeakPtr<Row> weak = copy;
+            assert(weak.Lock() == copy);
+            assert(frozen[1].UseCount() == 1);
+        }
+
+        pid_t child = fork();
+        assert(child >= 0);
+        if (child == 0) {
+            size_t before = PrivateDirtyBytes();
+            {
+                std::vector<SharedPtr<Row>> copies(frozen.begin(), frozen.end());
+            }
+            size_t frozen_growth = PrivateDirtyBytes() - before;
+            before = PrivateDirtyBytes();
+            {
+                std::vector<SharedPtr<Row>> copies(counted.begin(), counted.end());
+            }
+            size_t counted_growth = PrivateDirtyBytes() - before;
+            bool ok = before == 0 || (counted_growth >= 2 * 1024 * 1024 && frozen_growth < counted_growth / 8);
+            _exit(ok ? 0 : 1);
+        }
+        int status;
+        assert(waitpid(child, &status, 0) == child);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    std::cout << "++++++++++++++++ TEST 40 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 41: INTERPROCESS SHARED PTR ================" << '\n';
+    {
+        struct Record {
+            int values[4];
+            OffsetPtr<int> cursor;
+        };
+        auto segment = SharedSegment::CreateAnonymous(1 << 20);
+        assert(segment);
+        auto record = segment->Make<Record>(Record{{1, 2, 3, 4}, nullptr});
+        record->cursor = &record->values[2];
+        segment->SetRoot(0, record);
+        assert(record.UseCount() == 2);
+        assert(segment->LiveBlocks() == 1);
+
+        // The child ends without releasing anything, like a crashed worker
+        pid_t child = segment->Fork();
+        assert(child >= 0);
+        if (child == 0) {
+            auto root = segment->GetRoot<Record>(0);
+            bool ok = root && *root->cursor == 3 && record.UseCount() == 4;
+            auto orphan = segment->Make<Record>();
+            segment->SetRoot(1, segment->Make<Record>(Record{{7, 0, 0, 0}, nullptr}));
+            new InterprocessSharedPtr<Record>(orphan);
+            _exit(ok ? 0 : 1);
+        }
+        int status;
+        assert(waitpid(child, &status, 0) == child);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        assert(record.UseCount() == 4);
+        assert(segment->LiveBlocks() == 3);
+        assert(segment->Reap() == 1);
+        // Live processes, identified by pid and start time, are left alone
+        assert(segment->Reap() == 0);
+        assert(record.UseCount() == 2);
+        assert(segment->LiveBlocks() == 2);
+        assert(segment->GetRoot<Record>(1)->values[0] == 7);
+
+        // A second mapping of the same named segment lands at another address
+        std::string name = "/my_shared_ptr_test_" + std::to_string(getpid());
+        auto named = SharedSegment::Create(name, 1 << 16);
+        assert(named);
+        auto original = named->Make<Record>(Record{{5, 6, 7, 8}, nullptr});
+        original->cursor = &original->values[3];
+        named->SetRoot(0, original);
+        {
+            auto opened = SharedSegment::Open(name);
+            assert(opened);
+            auto view = opened->Acquire<Record>(original.Offset());
+            assert(view.Get() != original.Get());
+            assert(*view->cursor == 8);
+            assert(original.UseCount() == 3);
+        }
+        assert(original.UseCount() == 2);
+        assert(SharedSegment::Remove(name));
+        assert(!SharedSegment::Open(name));
+
+        segment->SetRoot(0, InterprocessSharedPtr<Record>());
+        segment->SetRoot(1, InterprocessSharedPtr<Record>());
+        assert(segment->LiveBlocks() == 1);
+        record.Reset();
+        assert(segment->LiveBlocks() == 0);
+    }
+    std::cout << "++++++++++++++++ TEST 41 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 42: GRAPH SERIALIZATION ================" << '\n';
+    {
+        // root -> {left, right}, both -> shared; shared -> root closes a strong cycle
+        auto root = MakeShared<GraphNode>();
+        root->name = "root";
+        auto left = MakeShared<GraphNode>(), right = MakeShared<GraphNode>(), shared = MakeShared<GraphNode>();
+        left->value = 1;
+        right->value = 2;
+        shared->value = 3;
+        shared->name = std::string(300, 's');
+        root->edges = {left, right};
+        left->edges = {shared};
+        right->edges = {shared, nullptr};
+        shared->parent = left;
+        shared->edges = {root};
+        // A chain long enough to overflow the stack of a recursive serializer
+        auto tail = left;
+        for (int i = 0; i < 10000; ++i) {
+            auto next = MakeShared<GraphNode>();
+            next->value = 100 + i;
+            next->parent = tail;
+            tail->edges.push_back(next);
+            tail = next;
+        }
+
+        char path[] = "/tmp/my_shared_ptr_graph_XXXXXX";
+        int fd = mkstemp(path);
+        assert(fd >= 0);
+        unlink(path);
+        assert(GraphWriter(fd, 64).WriteGraph(SharedPtr<const GraphNode>(root)));
+        off_t size = lseek(fd, 0, SEEK_CUR);
+
+        lseek(fd, 0, SEEK_SET);
+        SharedPtr<GraphNode> loaded;
+        assert(GraphReader(fd, 100).ReadGraph(&loaded));
+        assert(loaded->name == "root" && loaded->edges.size() == 2);
+        auto loaded_left = loaded->edges[0], loaded_right = loaded->edges[1];
+        assert(loaded_left->value == 1 && loaded_right->value == 2);
+        assert(loaded_left->edges[0] == loaded_right->edges[0]);
+        assert(loaded_right->edges[1] == nullptr);
+        auto loaded_shared = loaded_left->edges[0];
+        assert(loaded_shared->name == shared->name);
+        assert(loaded_shared->edges[0] == loaded);
+        assert(loaded_shared->parent.Lock() == loaded_left);
+        assert(loaded_shared.UseCount() == shared.UseCount());
+
+        auto loaded_tail = loaded_left;
+        for (int i = 0; i < 10000; ++i) {
+            auto next = loaded_tail->edges.back();
+            assert(next->value == 100 + i && next->parent.Lock() == loaded_tail);
+            loaded_tail = next;
+        }
+
+        // Truncated streams fail instead of producing half a graph
+        assert(ftruncate(fd, size - 1) == 0);
+        lseek(fd, 0, SEEK_SET);
+        SharedPtr<GraphNode> truncated;
+        assert(!GraphReader(fd).ReadGraph(&truncated));
+        close(fd);
+
+        // Break the cycles and the chains before they go out of scope
+        for (auto node : {root, loaded}) {
+            auto next = node->edges[0];
+            node->edges.clear();
+            while (next && !next->edges.empty()) {
+                auto current = next;
+                next = current->edges.back();
+                current->edges.clear();
+            }
+        }
+    }
+    {
+        // Aliasing pointers into one array share a control block but are different objects
+        auto arena = MakeShared<GraphNode[]>(2);
+        arena[0].value = 1;
+        arena[1].value = 2;
+        auto root = MakeShared<GraphNode>();
+        SharedPtr<GraphNode> first(arena, &arena[0]), second(arena, &arena[1]);
+        root->edges = {first, second, first};
+
+        char path[] = "/tmp/my_shared_ptr_graph_XXXXXX";
+        int fd = mkstemp(path);
+        assert(fd >= 0);
+        unlink(path);
+        assert(GraphWriter(fd).WriteGraph(root));
+        lseek(fd, 0, SEEK_SET);
+        SharedPtr<GraphNode> loaded;
+        assert(GraphReader(fd).ReadGraph(&loaded));
+        close(fd);
+        assert(loaded->edges.size() == 3);
+        assert(loaded->edges[0]->value == 1 && loaded->edges[1]->value == 2);
+        assert(loaded->edges[0] == loaded->edges[2] && loaded->edges[0] != loaded->edges[1]);
+    }
+    std::cout << "++++++++++++++++ TEST 42 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 43: MMAP SNAPSHOT ================" << '\n';
+    {
+        struct SnapNode {
+            int value;
+            OffsetPtr<SnapNode> next;
+        };
+        SnapshotBuilder builder;
+        size_t first = builder.Emplace<SnapNode>(SnapNode{1, nullptr});
+        size_t second = builder.Emplace<SnapNode>(SnapNode{2, nullptr});
+        size_t third = builder.Emplace<SnapNode>(SnapNode{3, nullptr});
+        builder.At<SnapNode>(first)->next = builder.At<SnapNode>(second);
+        builder.At<SnapNode>(second)->next = builder.At<SnapNode>(third);
+        assert(builder.AddRoot(first) == 0);
+        assert(builder.AddRoot(third) == 1);
+
+        char directory_template[] = "/tmp/my_shared_ptr_snapshot_XXXXXX";
+        std::string path = std::string(mkdtemp(directory_template)) + "/graph.snap";
+        assert(builder.WriteTo(path));
+
+        // Immortal mappings stay for the rest of the process
+        static auto& snapshot = *new Snapshot(Snapshot::Open(path));
+        assert(snapshot && snapshot.RootCount() == 2);
+        SharedPtr<const SnapNode> head;
+        EXPECT_ZERO_ALLOCATIONS(head = snapshot.Root<SnapNode>(0));
+        assert(head.IsImmortal());
+        assert(head->value == 1 && head->next->value == 2 && head->next->next->value == 3);
+        assert(head->next->next.Get() == snapshot.Root<SnapNode>(1).Get());
+        auto middle = snapshot.Share(head->next.Get());
+        assert(middle->value == 2);
+
+        auto edited = head;
+        snapshot.MakeMutable(edited).value = 10;
+        assert(!snapshot.Contains(edited.Get()) && edited.UseCount() == 1);
+        assert(edited->value == 10 && head->value == 1);
+        assert(edited->next.Get() == middle.Get());
+        const SnapNode* copy = edited.Get();
+        snapshot.MakeMutable(edited).value = 11;
+        assert(edited.Get() == copy && edited->value == 11);
+
+        // Roots that do not fit the requested type, or do not exist
+        using Megabyte = std::array<char, 1 << 20>;
+        assert(!snapshot.Root<Megabyte>(0));
+        assert(!snapshot.Root<SnapNode>(2));
+        std::ifstream file(path);
+        std::string image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        SnapshotHeader header;
+        std::memcpy(&header, image.data(), sizeof(header));
+        uint64_t past_objects = header.roots;
+        std::memcpy(image.data() + header.roots + sizeof(uint64_t), &past_objects, sizeof(past_objects));
+        std::ofstream(path + ".roots") << image;
+        assert(!Snapshot::Open(path + ".roots") && errno == EINVAL);
+
+        std::ofstream(path + ".bad") << "not a snapshot at all, just text";
+        assert(!Snapshot::Open(path + ".bad") && errno == EINVAL);
+        std::filesystem::remove_all(directory_template);
+        assert(!Snapshot::Open(path) && errno == ENOENT);
+    }
+    std::cout << "++++++++++++++++ TEST 43 - PASSED +++++++++++++++++" << '\n';
+
+    std::cout << "================ TEST 44: GRAPH SERIALIZATION - CORRUPT LENGTHS ================" << '\n';
+    {
+        // A root GraphNode whose name claims 2^48 bytes, followed by only a few of them
+        auto stream = [](const char* length) {
+            std::string bytes = "MSPG";
+            uint32_t version = 1;
+            int value = 7;
+            bytes.append(reinterpret_cast<const char*>(&version), sizeof(version));
+            bytes += '\x01';
+            bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+            return bytes + length + "abc";
+        };
+        for (const char* length : {"\x80\x80\x80\x80\x80\x80\x40", "\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01"}) {
+            std::string bytes = stream(length);
+
+            char path[] = "/tmp/my_shared_ptr_graph_XXXXXX";
+            int fd = mkstemp(path);
+            assert(fd >= 0);
+            unlink(path);
+            assert(write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+            lseek(fd, 0, SEEK_SET);
+            SharedPtr<GraphNode> from_file;
+            assert(!GraphReader(fd).ReadGraph(&from_file));
+            close(fd);
+
+            // The size of a pipe is unknown up front, only the missing bytes can stop it
+            int fds[2];
+            assert(pipe(fds) == 0);
+            assert(write(fds[1], bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+            close(fds[1]);
+            SharedPtr<GraphNode> from_pipe;
+            assert(!GraphReader(fds[0], 16).ReadGraph(&from_pipe));
+            close(fds[0]);
+        }
+    }
+    std::cout << "++++++++++++++++ TEST 44 - PASSED +++++++++++++++++" << '\n';
 }
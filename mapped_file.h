@@ -0,0 +1,128 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "shared.h"
+
+// Hints applied to a mapping; failures of individual hints are ignored
+enum class MapFlags : unsigned {
+    kNone = 0,
+    kSequential = 1 << 0,  // MADV_SEQUENTIAL: aggressive readahead, pages dropped behind
+    kRandom = 1 << 1,      // MADV_RANDOM: no readahead
+    kWillNeed = 1 << 2,    // MADV_WILLNEED: start reading the whole range now
+    kHugePage = 1 << 3,    // MADV_HUGEPAGE: back with transparent huge pages where supported
+    kPopulate = 1 << 4,    // MAP_POPULATE: prefault every page inside mmap
+};
+
+inline MapFlags operator|(MapFlags left, MapFlags right) {
+    return static_cast<MapFlags>(static_cast<unsigned>(left) | static_cast<unsigned>(right));
+}
+inline bool HasFlag(MapFlags flags, MapFlags flag) {
+    return static_cast<unsigned>(flags) & static_cast<unsigned>(flag);
+}
+
+// Applies the madvise hints in `flags` to the pages covering [data, data + length)
+inline void Advise(const void* data, size_t length, MapFlags flags) {
+    static const uintptr_t kPageSize = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~(kPageSize - 1);
+    size_t span = reinterpret_cast<uintptr_t>(data) + length - begin;
+    auto address = reinterpret_cast<void*>(begin);
+    if (HasFlag(flags, MapFlags::kSequential)) {
+        ::madvise(address, span, MADV_SEQUENTIAL);
+    }
+    if (HasFlag(flags, MapFlags::kRandom)) {
+        ::madvise(address, span, MADV_RANDOM);
+    }
+#ifdef MADV_HUGEPAGE
+    if (HasFlag(flags, MapFlags::kHugePage)) {
+        ::madvise(address, span, MADV_HUGEPAGE);
+    }
+#endif
+    if (HasFlag(flags, MapFlags::kWillNeed)) {
+        ::madvise(address, span, MADV_WILLNEED);
+    }
+}
+
+// Control block owning a whole mapping, unmapped on the last strong release
+class MappingControlBlock : public ControlBlockBase {
+public:
+    // Maps `length` bytes of `fd` read-only; empty pointer on error, see errno
+    static SharedPtr<const std::byte[]> Map(int fd, size_t length, MapFlags flags) {
+        int map_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        if (HasFlag(flags, MapFlags::kPopulate)) {
+            map_flags |= MAP_POPULATE;
+        }
+#endif
+        void* address = ::mmap(nullptr, length, PROT_READ, map_flags, fd, 0);
+        if (address == MAP_FAILED) {
+            return nullptr;
+        }
+        Advise(address, length, flags);
+        auto block = new MappingControlBlock(address, length);
+        return SharedPtr<const std::byte[]>(block, static_cast<const std::byte*>(address));
+    }
+
+    void DestroyObject() override {
+        ::munmap(address_, length_);
+        address_ = nullptr;
+    }
+
+private:
+    MappingControlBlock(void* address, size_t length) : address_(address), length_(length) {
+    }
+
+    void* address_;
+    size_t length_;
+};
+
+// Maps the whole file read-only. The descriptor is closed before returning, the mapping lives
+// until the last pointer into it (including slices) is gone. Stores the file size in `size`.
+// Returns an empty pointer on error (see errno) and for empty files.
+inline SharedPtr<const std::byte[]> MapShared(const std::string& path, MapFlags flags = MapFlags::kNone,
+                                              size_t* size = nullptr) {
+    if (size) {
+        *size = 0;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return nullptr;
+    }
+    auto length = static_cast<size_t>(status.st_size);
+    SharedPtr<const std::byte[]> mapping;
+    if (length > 0) {
+        mapping = MappingControlBlock::Map(fd, length, flags);
+    }
+    int error = errno;
+    ::close(fd);
+    errno = error;
+    if (size && mapping) {
+        *size = length;
+    }
+    return mapping;
+}
+
+// Typed view of the bytes at `offset`, sharing ownership of the mapping without copying.
+// The caller keeps the view within the mapped size; `offset` must be suitably aligned for U.
+template <typename U>
+SharedPtr<const U[]> SliceAs(const SharedPtr<const std::byte[]>& bytes, size_t offset) {
+    const std::byte* data = bytes.Get() + offset;
+    assert(reinterpret_cast<uintptr_t>(data) % alignof(U) == 0);
+    return SharedPtr<const U[]>(bytes, reinterpret_cast<const U*>(data));
+}
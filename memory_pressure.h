@@ -0,0 +1,228 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "shared_cache.h"
+
+enum class PressureLevel {
+    kNone,
+    kModerate,
+    kCritical,
+};
+
+// Watches cgroup v2 memory accounting (memory.current, memory.max, memory.events) and PSI
+// (/proc/pressure/memory) and asks registered caches to drop the entries that only they hold.
+// All paths come from Options, so tests can point the monitor at a fake directory tree.
+// Missing or unreadable files are treated as "no signal".
+class MemoryPressureMonitor {
+public:
+    struct Options {
+        std::string proc_root = "/proc";
+        std::string cgroup_root = "/sys/fs/cgroup";
+        // Directory of this process' cgroup; resolved through <proc_root>/self/cgroup when empty
+        std::string cgroup_dir;
+
+        // Thresholds on memory.current / memory.max
+        double moderate_usage = 0.80;
+        double critical_usage = 0.95;
+        // Thresholds on the PSI 10 second averages, in percent
+        double moderate_some_avg10 = 10.0;
+        double critical_full_avg10 = 10.0;
+    };
+
+    struct Sample {
+        size_t current = 0;
+        size_t limit = 0;  // 0 when unlimited
+        size_t high_events = 0;
+        size_t max_events = 0;
+        size_t oom_events = 0;
+        double some_avg10 = 0;
+        double full_avg10 = 0;
+    };
+
+    // Drops entries for the given level, returns how many were dropped
+    using Shedder = std::function<size_t(PressureLevel)>;
+
+    MemoryPressureMonitor() : MemoryPressureMonitor(Options()) {
+    }
+    explicit MemoryPressureMonitor(Options options) : options_(std::move(options)) {
+        if (options_.cgroup_dir.empty()) {
+            options_.cgroup_dir = ResolveCgroupDir();
+        }
+        previous_ = ReadSample();
+    }
+
+    MemoryPressureMonitor(const MemoryPressureMonitor&) = delete;
+    MemoryPressureMonitor& operator=(const MemoryPressureMonitor&) = delete;
+
+    ~MemoryPressureMonitor() {
+        Stop();
+    }
+
+    size_t Register(Shedder shedder) {
+        std::lock_guard lock(mutex_);
+        shedders_.emplace(next_id_, std::move(shedder));
+        return next_id_++;
+    }
+
+    // Moderate pressure sheds half of the cache-only entries, critical pressure sheds all of them
+    template <typename K, typename V, typename Hash>
+    size_t Register(SharedCache<K, V, Hash>& cache) {
+        return Register([&cache](PressureLevel level) {
+            size_t limit = level == PressureLevel::kCritical ? SIZE_MAX : (cache.CountUnused() + 1) / 2;
+            return cache.ShedUnused(limit);
+        });
+    }
+
+    // Blocks until a concurrent Poll has finished with the shedder
+    void Unregister(size_t id) {
+        std::lock_guard lock(mutex_);
+        shedders_.erase(id);
+    }
+
+    Sample ReadSample() const {
+        Sample sample;
+        ReadNumber(options_.cgroup_dir + "/memory.current", &sample.current);
+        ReadNumber(options_.cgroup_dir + "/memory.max", &sample.limit);
+
+        std::ifstream events(options_.cgroup_dir + "/memory.events");
+        std::string key;
+        size_t value;
+        while (events >> key >> value) {
+            if (key == "high") {
+                sample.high_events = value;
+            } else if (key == "max") {
+                sample.max_events = value;
+            } else if (key == "oom") {
+                sample.oom_events = value;
+            }
+        }
+
+        std::ifstream pressure(options_.proc_root + "/pressure/memory");
+        std::string line;
+        while (std::getline(pressure, line)) {
+            std::istringstream fields(line);
+            std::string kind, avg10;
+            fields >> kind >> avg10;
+            if (avg10.rfind("avg10=", 0) != 0) {
+                continue;
+            }
+            double percent = std::strtod(avg10.c_str() + 6, nullptr);
+            if (kind == "some") {
+                sample.some_avg10 = percent;
+            } else if (kind == "full") {
+                sample.full_avg10 = percent;
+            }
+        }
+        return sample;
+    }
+
+    // Event counters are compared against the previous sample
+    PressureLevel Evaluate(const Sample& sample, const Sample& previous) const {
+        double usage = sample.limit ? static_cast<double>(sample.current) / sample.limit : 0.0;
+        if (usage >= options_.critical_usage || sample.max_events > previous.max_events ||
+            sample.oom_events > previous.oom_events ||
+            sample.full_avg10 >= options_.critical_full_avg10) {
+            return PressureLevel::kCritical;
+        }
+        if (usage >= options_.moderate_usage || sample.high_events > previous.high_events ||
+            sample.some_avg10 >= options_.moderate_some_avg10) {
+            return PressureLevel::kModerate;
+        }
+        return PressureLevel::kNone;
+    }
+
+    // Reads the signals once and sheds if needed, returns the observed level
+    PressureLevel Poll() {
+        std::lock_guard lock(mutex_);
+        Sample sample = ReadSample();
+        PressureLevel level = Evaluate(sample, previous_);
+        previous_ = sample;
+        if (level != PressureLevel::kNone) {
+            for (auto& [id, shedder] : shedders_) {
+                shed_count_ += shedder(level);
+            }
+        }
+        return level;
+    }
+
+    // Polls from a background thread until Stop
+    void Start(std::chrono::milliseconds interval) {
+        Stop();
+        stopping_ = false;
+        thread_ = std::thread([this, interval] {
+            std::unique_lock lock(thread_mutex_);
+            while (!stop_condition_.wait_for(lock, interval, [this] { return stopping_; })) {
+                lock.unlock();
+                Poll();
+                lock.lock();
+            }
+        });
+    }
+
+    void Stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard lock(thread_mutex_);
+            stopping_ = true;
+        }
+        stop_condition_.notify_all();
+        thread_.join();
+    }
+
+    // Total number of entries dropped so far
+    size_t ShedCount() const {
+        std::lock_guard lock(mutex_);
+        return shed_count_;
+    }
+
+private:
+    // "max" and missing files leave the value at 0
+    static void ReadNumber(const std::string& path, size_t* value) {
+        std::ifstream file(path);
+        size_t number;
+        if (file >> number) {
+            *value = number;
+        }
+    }
+
+    // The cgroup v2 entry of /proc/self/cgroup looks like "0::/path/of/the/group"
+    std::string ResolveCgroupDir() const {
+        std::ifstream file(options_.proc_root + "/self/cgroup");
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.rfind("0::", 0) == 0) {
+                std::string path = line.substr(3);
+                return path == "/" ? options_.cgroup_root : options_.cgroup_root + path;
+            }
+        }
+        return options_.cgroup_root;
+    }
+
+    Options options_;
+
+    mutable std::mutex mutex_;
+    std::map<size_t, Shedder> shedders_;
+    size_t next_id_ = 0;
+    Sample previous_;
+    size_t shed_count_ = 0;
+
+    std::thread thread_;
+    std::mutex thread_mutex_;
+    std::condition_variable stop_condition_;
+    bool stopping_ = false;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Pointer stored inside a shared segment or snapshot file: a signed offset from its own address,
+// so it stays valid wherever the memory gets mapped and when the bytes holding it are copied as a
+// whole. Points within the same mapping only.
+template <typename T>
+class OffsetPtr {
+public:
+    OffsetPtr() = default;
+    OffsetPtr(std::nullptr_t) {
+    }
+    OffsetPtr(T* ptr) {
+        Set(ptr);
+    }
+    OffsetPtr(const OffsetPtr& other) {
+        Set(other.Get());
+    }
+    OffsetPtr& operator=(const OffsetPtr& other) {
+        Set(other.Get());
+        return *this;
+    }
+    OffsetPtr& operator=(T* ptr) {
+        Set(ptr);
+        return *this;
+    }
+
+    T* Get() const {
+        if (offset_ == 0) {
+            return nullptr;
+        }
+        return reinterpret_cast<T*>(reinterpret_cast<intptr_t>(this) + offset_);
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    explicit operator bool() const {
+        return offset_ != 0;
+    }
+
+private:
+    void Set(T* ptr) {
+        offset_ = ptr ? reinterpret_cast<intptr_t>(ptr) - reinterpret_cast<intptr_t>(this) : 0;
+    }
+
+    // 0 is null: an OffsetPtr never points at itself
+    intptr_t offset_ = 0;
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "shared.h"
+
+// Copies a value that a writer may be modifying concurrently; the caller validates the copy
+// with the sequence counter. 32..64 byte values that are a multiple of 16 bytes are moved with
+// unaligned SSE2 loads and stores, the rest goes through memcpy.
+template <typename T>
+inline void SeqCopy(T* dst, const T* src) {
+#if defined(__SSE2__)
+    if constexpr (sizeof(T) >= 32 && sizeof(T) <= 64 && sizeof(T) % 16 == 0) {
+        auto from = reinterpret_cast<const __m128i*>(src);
+        auto to = reinterpret_cast<__m128i*>(dst);
+        for (size_t i = 0; i < sizeof(T) / 16; ++i) {
+            _mm_storeu_si128(to + i, _mm_loadu_si128(from + i));
+        }
+        return;
+    }
+#endif
+    std::memcpy(static_cast<void*>(dst), static_cast<const void*>(src), sizeof(T));
+}
+
+// Shared small trivially-copyable value protected by a seqlock.
+// Readers copy the value and retry if a write overlapped; they never write to shared memory.
+// Writers are serialized through the odd state of the sequence counter.
+template <typename T>
+class SharedSeqValue {
+    static_assert(std::is_trivially_copyable_v<T>, "SharedSeqValue requires a trivially copyable T");
+
+private:
+    struct State {
+        template <typename... Args>
+        explicit State(Args&&... args) : value(std::forward<Args>(args)...) {
+        }
+
+        alignas(64) std::atomic<uint64_t> sequence{0};
+        T value;
+    };
+
+    template <typename Y, typename... Args>
+    friend SharedSeqValue<Y> MakeSharedSeqValue(Args&&... args);
+
+    explicit SharedSeqValue(SharedPtr<State> state) : state_(std::move(state)) {
+    }
+
+    SharedPtr<State> state_;
+
+public:
+    SharedSeqValue() = default;
+
+    T Load() const {
+        T result;
+        for (size_t spins = 0;; ++spins) {
+            uint64_t before = state_->sequence.load(std::memory_order_acquire);
+            if (!(before & 1)) {
+                SeqCopy(&result, &state_->value);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (state_->sequence.load(std::memory_order_relaxed) == before) {
+                    return result;
+                }
+            }
+            if (spins >= 64) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void Store(const T& value) const {
+        Update([&value](T& current) { current = value; });
+    }
+
+    // Calls `f(T&)` on a private copy and publishes it as one write
+    template <typename F>
+    void Update(F&& f) const {
+        uint64_t sequence = Lock();
+        T value;
+        std::memcpy(static_cast<void*>(&value), static_cast<const void*>(&state_->value), sizeof(T));
+        std::forward<F>(f)(value);
+        std::atomic_thread_fence(std::memory_order_release);
+        SeqCopy(&state_->value, &value);
+        state_->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Number of completed writes
+    uint64_t Version() const {
+        return state_->sequence.load(std::memory_order_acquire) / 2;
+    }
+
+    size_t UseCount() const {
+        return state_.UseCount();
+    }
+    explicit operator bool() const {
+        return static_cast<bool>(state_);
+    }
+
+private:
+    // Makes the sequence odd, returns its previous even value
+    uint64_t Lock() const {
+        uint64_t sequence = state_->sequence.load(std::memory_order_relaxed);
+        for (size_t spins = 0;; ++spins) {
+            if (!(sequence & 1) &&
+                state_->sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire,
+                                                       std::memory_order_relaxed)) {
+                return sequence;
+            }
+            if (spins >= 64) {
+                std::this_thread::yield();
+            }
+            sequence = state_->sequence.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+template <typename T, typename... Args>
+SharedSeqValue<T> MakeSharedSeqValue(Args&&... args) {
+    using State = typename SharedSeqValue<T>::State;
+    return SharedSeqValue<T>(MakeShared<State>(std::forward<Args>(args)...));
+}
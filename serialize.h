@@ -0,0 +1,382 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "block_pool.h"
+#include "shared.h"
+
+// Binary streaming serialization of SharedPtr graphs.
+// Every object reachable from the root is written once, in breadth-first order of its first
+// reference, and references are written as ids, so shared nodes stay shared and cycles (strong
+// or through WeakPtr) round-trip. Nothing recurses, so deep graphs are fine.
+//
+// Types opt in with two functions found by ADL:
+//     void Serialize(GraphWriter& writer, const T& value);
+//     void Deserialize(GraphReader& reader, T& value);
+// which Write/Read their fields in the same order. Trivially copyable fields, strings, vectors,
+// SharedPtr and WeakPtr are handled here. Pointees are created by default construction and
+// filled in later, so referenced types must be default constructible. Objects are identified by
+// address and static type, so aliasing pointers into one allocation (array elements, buffer
+// slices) are written as separate objects, and pointers are restored with their static type.
+//
+// Both sides stream through a fixed-size buffer; apart from it memory grows only with the id
+// table. Trivially copyable values use the native byte order.
+class GraphWriter {
+public:
+    static constexpr size_t kDefaultBufferSize = 64 * 1024;
+
+    explicit GraphWriter(int fd, size_t buffer_size = kDefaultBufferSize) : fd_(fd), buffer_(buffer_size) {
+    }
+
+    // Writes the header and the whole graph, then flushes; false on a write error (see errno)
+    template <typename T>
+    bool WriteGraph(const SharedPtr<T>& root) {
+        WriteBytes(kMagic, sizeof(kMagic));
+        Write(kVersion);
+        Write(root);
+        while (!pending_.empty() && ok_) {
+            Pending next = pending_.front();
+            pending_.pop_front();
+            next.save(*this, next.object);
+        }
+        Flush();
+        return ok_;
+    }
+
+    void WriteBytes(const void* data, size_t size) {
+        auto bytes = static_cast<const char*>(data);
+        while (size > 0 && ok_) {
+            if (used_ == buffer_.size()) {
+                Flush();
+            }
+            size_t chunk = std::min(size, buffer_.size() - used_);
+            std::memcpy(buffer_.data() + used_, bytes, chunk);
+            used_ += chunk;
+            bytes += chunk;
+            size -= chunk;
+        }
+    }
+
+    // LEB128
+    void WriteVarint(uint64_t value) {
+        char bytes[10];
+        size_t size = 0;
+        do {
+            bytes[size++] = static_cast<char>((value & 0x7f) | (value >= 0x80 ? 0x80 : 0));
+            value >>= 7;
+        } while (value);
+        WriteBytes(bytes, size);
+    }
+
+    template <typename T>
+    void Write(const T& value) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            WriteBytes(&value, sizeof(T));
+        } else {
+            Serialize(*this, value);
+        }
+    }
+    void Write(const std::string& value) {
+        WriteVarint(value.size());
+        WriteBytes(value.data(), value.size());
+    }
+    template <typename T>
+    void Write(const std::vector<T>& values) {
+        WriteVarint(values.size());
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            WriteBytes(values.data(), values.size() * sizeof(T));
+        } else {
+            for (const auto& value : values) {
+                Write(value);
+            }
+        }
+    }
+
+    // 0 for null, otherwise the object's id; a new id queues the object to be written
+    template <typename T>
+    void Write(const SharedPtr<T>& ptr) {
+        if (!ptr) {
+            WriteVarint(0);
+            return;
+        }
+        using Object = std::remove_const_t<T>;
+        auto [it, inserted] = ids_.try_emplace(ObjectKey{ptr.Get(), &kTypeTag<Object>}, ids_.size() + 1, ptr);
+        WriteVarint(it->second.id);
+        if (inserted) {
+            pending_.push_back({ptr.Get(), &SaveObject<Object>});
+        }
+    }
+    // Expired pointers are written as null
+    template <typename T>
+    void Write(const WeakPtr<T>& ptr) {
+        Write(ptr.Lock());
+    }
+
+    bool Ok() const {
+        return ok_;
+    }
+
+private:
+    friend class GraphReader;
+
+    static constexpr char kMagic[4] = {'M', 'S', 'P', 'G'};
+    static constexpr uint32_t kVersion = 1;
+
+    struct Pending {
+        const void* object;
+        void (*save)(GraphWriter&, const void*);
+    };
+
+    template <typename T>
+    static constexpr char kTypeTag = 0;
+
+    struct ObjectKey {
+        const void* object;
+        const char* type;
+
+        bool operator==(const ObjectKey&) const = default;
+    };
+    struct ObjectKeyHash {
+        size_t operator()(const ObjectKey& key) const {
+            return std::hash<const void*>{}(key.object) * 31 + std::hash<const char*>{}(key.type);
+        }
+    };
+    struct Id {
+        uint64_t id;
+        // Keeps the written object alive until the writer is gone
+        SharedPtr<const void> owner;
+    };
+
+    template <typename T>
+    static void SaveObject(GraphWriter& writer, const void* object) {
+        writer.Write(*static_cast<const T*>(object));
+    }
+
+    void Flush() {
+        size_t written = 0;
+        while (written < used_ && ok_) {
+            ssize_t count = ::write(fd_, buffer_.data() + written, used_ - written);
+            if (count > 0) {
+                written += static_cast<size_t>(count);
+            } else if (count < 0 && errno != EINTR) {
+                ok_ = false;
+            }
+        }
+        used_ = 0;
+    }
+
+    int fd_;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+    bool ok_ = true;
+    std::unordered_map<ObjectKey, Id, ObjectKeyHash> ids_;
+    std::deque<Pending> pending_;
+};
+
+class GraphReader {
+public:
+    static constexpr size_t kDefaultBufferSize = GraphWriter::kDefaultBufferSize;
+
+    explicit GraphReader(int fd, size_t buffer_size = kDefaultBufferSize) : fd_(fd), buffer_(buffer_size) {
+        struct stat info;
+        off_t offset;
+        if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && (offset = ::lseek(fd, 0, SEEK_CUR)) >= 0) {
+            unread_ = info.st_size > offset ? static_cast<uint64_t>(info.st_size - offset) : 0;
+        }
+    }
+
+    // Rebuilds a graph written by GraphWriter::WriteGraph. Objects are created in the order they
+    // were written with MakeSharedPooled, so neighbours in the graph end up close in memory.
+    // False on read errors, truncated or malformed input.
+    template <typename T>
+    bool ReadGraph(SharedPtr<T>* root) {
+        char magic[sizeof(GraphWriter::kMagic)];
+        uint32_t version = 0;
+        ReadBytes(magic, sizeof(magic));
+        Read(version);
+        if (!ok_ || std::memcmp(magic, GraphWriter::kMagic, sizeof(magic)) != 0 || version != GraphWriter::kVersion) {
+            return false;
+        }
+        Read(*root);
+        while (!pending_.empty() && ok_) {
+            Pending next = pending_.front();
+            pending_.pop_front();
+            next.load(*this, next.object);
+        }
+        return ok_;
+    }
+
+    void ReadBytes(void* data, size_t size) {
+        auto bytes = static_cast<char*>(data);
+        while (size > 0 && ok_) {
+            if (position_ == filled_) {
+                Refill();
+                continue;
+            }
+            size_t chunk = std::min(size, filled_ - position_);
+            std::memcpy(bytes, buffer_.data() + position_, chunk);
+            position_ += chunk;
+            bytes += chunk;
+            size -= chunk;
+        }
+        if (!ok_) {
+            std::memset(bytes, 0, size);
+        }
+    }
+
+    uint64_t ReadVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64 && ok_; shift += 7) {
+            unsigned char byte;
+            ReadBytes(&byte, 1);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    template <typename T>
+    void Read(T& value) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            ReadBytes(&value, sizeof(T));
+        } else {
+            Deserialize(*this, value);
+        }
+    }
+    void Read(std::string& value) {
+        ReadSequence(value, ReadLength(1));
+    }
+    // Every element of a vector takes at least one byte of input
+    template <typename T>
+    void Read(std::vector<T>& values) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            ReadSequence(values, ReadLength(sizeof(T)));
+        } else {
+            size_t length = ReadLength(1);
+            values.clear();
+            values.reserve(std::min(length, buffer_.size()));
+            while (values.size() < length && ok_) {
+                Read(values.emplace_back());
+            }
+        }
+    }
+
+    template <typename T>
+    void Read(SharedPtr<T>& ptr) {
+        using Object = std::remove_const_t<T>;
+        uint64_t id = ReadVarint();
+        if (id == 0 || !ok_) {
+            ptr = nullptr;
+        } else if (id == objects_.size() + 1) {
+            auto object = MakeSharedPooled<Object>();
+            pending_.push_back({object.Get(), &LoadObject<Object>});
+            objects_.push_back({object, &kTypeTag<Object>});
+            ptr = std::move(object);
+        } else if (id <= objects_.size() && objects_[id - 1].type == &kTypeTag<Object>) {
+            const auto& object = objects_[id - 1].ptr;
+            ptr = SharedPtr<T>(object, static_cast<Object*>(object.Get()));
+        } else {
+            ok_ = false;
+            ptr = nullptr;
+        }
+    }
+    template <typename T>
+    void Read(WeakPtr<T>& ptr) {
+        SharedPtr<T> strong;
+        Read(strong);
+        ptr = strong;
+    }
+
+    bool Ok() const {
+        return ok_;
+    }
+
+private:
+    template <typename T>
+    static constexpr char kTypeTag = 0;
+
+    struct Object {
+        SharedPtr<void> ptr;
+        const char* type;
+    };
+    struct Pending {
+        void* object;
+        void (*load)(GraphReader&, void*);
+    };
+
+    template <typename T>
+    static void LoadObject(GraphReader& reader, void* object) {
+        reader.Read(*static_cast<T*>(object));
+    }
+
+    void Refill() {
+        ssize_t count;
+        do {
+            count = ::read(fd_, buffer_.data(), buffer_.size());
+        } while (count < 0 && errno == EINTR);
+        if (count <= 0) {
+            ok_ = false;
+            return;
+        }
+        position_ = 0;
+        filled_ = static_cast<size_t>(count);
+        if (unread_ != kUnknown) {
+            unread_ -= std::min<uint64_t>(unread_, filled_);
+        }
+    }
+
+    // A sequence length of elements taking at least `element_bytes` each. Lengths the rest of
+    // the input cannot hold make it malformed before anything is allocated for them.
+    size_t ReadLength(size_t element_bytes) {
+        uint64_t length = ReadVarint();
+        uint64_t remaining = unread_ == kUnknown ? kUnknown : unread_ + (filled_ - position_);
+        if (length > remaining / element_bytes || length > std::numeric_limits<size_t>::max() / element_bytes) {
+            ok_ = false;
+        }
+        return ok_ ? static_cast<size_t>(length) : 0;
+    }
+
+    // Grows `values` only as its bytes arrive, so a length past the end of a pipe fails after
+    // allocating about as much as was actually received
+    template <typename Sequence>
+    void ReadSequence(Sequence& values, size_t length) {
+        using T = typename Sequence::value_type;
+        values.clear();
+        while (values.size() < length && ok_) {
+            size_t done = values.size();
+            size_t step = std::min(length - done, std::max(done, buffer_.size() / sizeof(T) + 1));
+            values.resize(done + step);
+            ReadBytes(values.data() + done, step * sizeof(T));
+        }
+    }
+
+    int fd_;
+    std::vector<char> buffer_;
+    size_t position_ = 0;
+    size_t filled_ = 0;
+    // Bytes the fd has not delivered yet, known for regular files only
+    static constexpr uint64_t kUnknown = std::numeric_limits<uint64_t>::max();
+    uint64_t unread_ = kUnknown;
+    bool ok_ = true;
+    // Objects by id - 1, kept alive until the reader is gone
+    std::vector<Object> objects_;
+    std::deque<Pending> pending_;
+};
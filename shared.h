@@ -1,14 +1,217 @@
 #pragma once
 
+#include <sys/mman.h>
+
+#include <atomic>
+#include <compare>
 #include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class ControlBlockBase;
+
+// Waiters and last-release hooks of observed control blocks.
+// Blocks nobody observes never touch this table: the observed flag lives in the reference count
+// and is tested on the value `fetch_sub` returns anyway.
+class ReleaseObservers {
+public:
+    // Called with the number of remaining references, 1 or 0
+    using Hook = std::function<void(size_t)>;
+
+    static ReleaseObservers& Instance() {
+        static ReleaseObservers observers;
+        return observers;
+    }
+
+    // Waiters sleep on a process-wide word rather than on the block, so notifying never touches
+    // a block that the woken thread may already have freed
+    std::atomic<uint32_t>& WaitWord(const ControlBlockBase* block) {
+        return words_[std::hash<const ControlBlockBase*>{}(block) % kWords];
+    }
+
+    void Subscribe(ControlBlockBase* block, Hook hook);
+    // Wakes waiters and runs the hooks; `old` is the count word before a decrement that left at
+    // most one reference. With one left the releaser holds nothing and the block may be gone
+    // already, so its hooks are only looked up under the stamp the decrement saw.
+    void Notify(ControlBlockBase* block, size_t old);
+
+private:
+    static constexpr size_t kWords = 64;
+
+    struct Hooks {
+        uint32_t stamp;
+        std::vector<Hook> hooks;
+    };
+
+    std::atomic<uint32_t> words_[kWords]{};
+    std::mutex mutex_;
+    std::unordered_map<ControlBlockBase*, Hooks> hooks_;
+    uint32_t next_stamp_ = 0;
+};
 
 class ControlBlockBase {
 public:
-    size_t ref_cnt = 1;
+    // Set once somebody waits for or subscribes to the count dropping to one
+    static constexpr size_t kObservedBit = size_t{1} << (sizeof(size_t) * 8 - 1);
+    // Set by MakeImmortal together with `immortal`; decrements that raced with it see it in the
+    // value `fetch_sub` returns
+    static constexpr size_t kImmortalBit = kObservedBit >> 1;
+    // Identifies the block's hooks in ReleaseObservers, unlike its address, which a later block
+    // may get; set once, by the first Subscribe. Never 0 once set.
+    static constexpr size_t kStampShift = 40;
+    static constexpr size_t kStampMask = (kImmortalBit - 1) >> kStampShift;
+    static constexpr size_t kCountMask = (size_t{1} << kStampShift) - 1;
+
+    std::atomic<size_t> ref_cnt = 1;
+    // Weak references, plus one held collectively by the strong ones
+    std::atomic<uint32_t> weak_cnt = 1;
+    // Counts are no longer written and the object is never destroyed. Kept apart from ref_cnt:
+    // a load of the word that the previous locked operation wrote stalls until that one retires.
+    std::atomic<bool> immortal = false;
 
     virtual ~ControlBlockBase() = default;
+
+    // Destroys the managed object; the block itself outlives it while weak references remain
+    virtual void DestroyObject() = 0;
+    // Frees the block, overridden by blocks that do not come from plain `new`
+    virtual void DestroyBlock() {
+        delete this;
+    }
+
+    size_t UseCount() const {
+        return ref_cnt.load(std::memory_order_relaxed) & kCountMask;
+    }
+
+    bool IsImmortal() const {
+        return immortal.load(std::memory_order_relaxed);
+    }
+
+    // Immortal blocks are only read, so pages holding them stay shared after fork
+    void IncRef() {
+        if (IsImmortal()) [[unlikely]] {
+            return;
+        }
+        ref_cnt.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Destroys the object when the last strong reference is dropped
+    void DecRef() {
+        if (IsImmortal()) [[unlikely]] {
+            return;
+        }
+        size_t old = ref_cnt.fetch_sub(1, std::memory_order_acq_rel);
+        if (old & kImmortalBit) [[unlikely]] {
+            // Made immortal between the check and the decrement; the count no longer matters
+            return;
+        }
+        if (old & kObservedBit) [[unlikely]] {
+            if ((old & kCountMask) <= 2) {
+                ReleaseObservers::Instance().Notify(this, old);
+            }
+        }
+        if ((old & kCountMask) == 1) {
+            DestroyObject();
+            DecWeak();
+        }
+    }
+    // Takes a strong reference unless the object is already being destroyed
+    bool TryIncRef() {
+        size_t count = ref_cnt.load(std::memory_order_relaxed);
+        if (count & kImmortalBit) [[unlikely]] {
+            return true;
+        }
+        while ((count & kCountMask) != 0) {
+            if (ref_cnt.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Immortal blocks are never freed, so weak counts stop being tracked as well
+    void IncWeak() {
+        if (IsImmortal()) [[unlikely]] {
+            return;
+        }
+        weak_cnt.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Destroys the block when the last weak reference is dropped
+    void DecWeak() {
+        if (IsImmortal()) [[unlikely]] {
+            return;
+        }
+        if (weak_cnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            DestroyBlock();
+        }
+    }
+
+    void MarkObserved() {
+        ref_cnt.fetch_or(kObservedBit, std::memory_order_seq_cst);
+    }
+    // Requires a live strong reference held by the caller
+    void MakeImmortal() {
+        if (!IsImmortal()) {
+            immortal.store(true, std::memory_order_relaxed);
+            ref_cnt.fetch_or(kImmortalBit, std::memory_order_relaxed);
+        }
+    }
 };
 
+// Hooks keep a weak reference on the block, so it stays allocated while they are registered.
+// The stamp is published in the count word together with the observed bit, so a decrement that
+// comes later in the word's order finds the hooks.
+inline void ReleaseObservers::Subscribe(ControlBlockBase* block, Hook hook) {
+    std::lock_guard lock(mutex_);
+    auto& entry = hooks_[block];
+    if (entry.hooks.empty()) {
+        block->IncWeak();
+        next_stamp_ = next_stamp_ % ControlBlockBase::kStampMask + 1;
+        entry.stamp = next_stamp_;
+        size_t stamp = size_t{entry.stamp} << ControlBlockBase::kStampShift;
+        block->ref_cnt.fetch_or(ControlBlockBase::kObservedBit | stamp, std::memory_order_seq_cst);
+    }
+    entry.hooks.push_back(std::move(hook));
+}
+
+inline void ReleaseObservers::Notify(ControlBlockBase* block, size_t old) {
+    size_t remaining = (old & ControlBlockBase::kCountMask) - 1;
+    auto stamp = static_cast<uint32_t>(old >> ControlBlockBase::kStampShift & ControlBlockBase::kStampMask);
+    auto& word = WaitWord(block);
+    word.fetch_add(1, std::memory_order_seq_cst);
+    word.notify_all();
+
+    std::vector<Hook> hooks;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = hooks_.find(block);
+        // No stamp: nobody had subscribed yet when the count dropped. Another stamp: the block
+        // was freed meanwhile and a new one at its address subscribed to.
+        if (it == hooks_.end() || it->second.stamp != stamp) {
+            return;
+        }
+        // The matching entry's weak reference still keeps the block allocated
+        if (remaining == 0) {
+            hooks = std::move(it->second.hooks);
+            hooks_.erase(it);
+        } else {
+            hooks = it->second.hooks;
+        }
+    }
+    for (auto& hook : hooks) {
+        hook(remaining);
+    }
+    if (remaining == 0) {
+        // Never the last weak reference: the strong ones still hold theirs
+        block->DecWeak();
+    }
+}
+
 template <typename Y>
 class ControlBlockPtr : public ControlBlockBase {
 public:
@@ -16,10 +219,23 @@ public:
     ControlBlockPtr(Y* ptr = nullptr) : ptr_(ptr) {
     }
 
-    ~ControlBlockPtr() {
-        if (ptr_) {
-            delete ptr_;
-        }
+    void DestroyObject() override {
+        delete ptr_;
+        ptr_ = nullptr;
+    }
+};
+
+// Owns an array allocated with `new[]`
+template <typename Y>
+class ControlBlockArrayPtr : public ControlBlockBase {
+public:
+    Y* ptr_;
+    ControlBlockArrayPtr(Y* ptr = nullptr) : ptr_(ptr) {
+    }
+
+    void DestroyObject() override {
+        delete[] ptr_;
+        ptr_ = nullptr;
     }
 };
 
@@ -32,8 +248,9 @@ public:
     ControlBlockHolder(Args&&... args) {
         new (&storage_) Y(std::forward<Args>(args)...);
     }
-    ~ControlBlockHolder() {
-        reinterpret_cast<Y*>(&storage_)->~Y();
+
+    void DestroyObject() override {
+        GetRawPointer()->~Y();
     }
 
     Y* GetRawPointer() {
@@ -41,19 +258,186 @@ public:
     }
 };
 
+// Direct mmap allocation for objects too big for malloc to handle well: every object gets its
+// own mapping, so freeing it returns the pages immediately instead of fragmenting the heap.
+class LargeObjects {
+public:
+    // Objects below this size never take the mmap path, whatever the threshold
+    static constexpr size_t kMinSize = 64 * 1024;
+    static constexpr size_t kPageSize = 4096;
+
+    // Blocks of at least `bytes` (default 1 MiB) are mapped directly
+    static void SetThreshold(size_t bytes) {
+        Threshold().store(bytes, std::memory_order_relaxed);
+    }
+    // Requests transparent huge pages for new large objects
+    static void SetHugePages(bool enable) {
+        HugePages().store(enable, std::memory_order_relaxed);
+    }
+
+    static bool IsLarge(size_t size) {
+        return size >= kMinSize && size >= Threshold().load(std::memory_order_relaxed);
+    }
+
+    static void* Allocate(size_t size) {
+        void* ptr = ::mmap(nullptr, RoundUp(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (HugePages().load(std::memory_order_relaxed)) {
+            ::madvise(ptr, RoundUp(size), MADV_HUGEPAGE);
+        }
+#endif
+        return ptr;
+    }
+    static void Deallocate(void* ptr, size_t size) {
+        ::munmap(ptr, RoundUp(size));
+    }
+
+private:
+    static size_t RoundUp(size_t size) {
+        return (size + kPageSize - 1) & ~(kPageSize - 1);
+    }
+
+    static std::atomic<size_t>& Threshold() {
+        static std::atomic<size_t> threshold{size_t{1} << 20};
+        return threshold;
+    }
+    static std::atomic<bool>& HugePages() {
+        static std::atomic<bool> huge_pages{false};
+        return huge_pages;
+    }
+};
+
+// ControlBlockHolder living in its own mapping
+template <typename Y>
+class LargeControlBlockHolder : public ControlBlockHolder<Y> {
+public:
+    using ControlBlockHolder<Y>::ControlBlockHolder;
+
+    static void* operator new(size_t size) {
+        return LargeObjects::Allocate(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        LargeObjects::Deallocate(ptr, size);
+    }
+};
+
+// Control block followed by `size` value-initialized elements, one allocation per array
+template <typename E>
+class ArrayControlBlock : public ControlBlockBase {
+    static_assert(alignof(E) <= alignof(std::max_align_t), "over-aligned array elements");
+
+public:
+    // Throws std::bad_array_new_length if the block size overflows. If an element constructor
+    // throws, the elements built so far are destroyed in reverse order and the block is freed.
+    static ArrayControlBlock* Create(size_t size) {
+        if (size > (SIZE_MAX - ElementsOffset()) / sizeof(E)) {
+            throw std::bad_array_new_length();
+        }
+        size_t bytes = ElementsOffset() + size * sizeof(E);
+        bool large = LargeObjects::IsLarge(bytes);
+        void* memory = large ? LargeObjects::Allocate(bytes) : ::operator new(bytes);
+        auto block = new (memory) ArrayControlBlock(size, large);
+        size_t i = 0;
+        try {
+            for (; i < size; ++i) {
+                new (block->Elements() + i) E();
+            }
+        } catch (...) {
+            while (i > 0) {
+                block->Elements()[--i].~E();
+            }
+            block->~ArrayControlBlock();
+            if (large) {
+                LargeObjects::Deallocate(memory, bytes);
+            } else {
+                ::operator delete(memory);
+            }
+            throw;
+        }
+        return block;
+    }
+
+    E* Elements() {
+        return reinterpret_cast<E*>(reinterpret_cast<char*>(this) + ElementsOffset());
+    }
+
+    void DestroyObject() override {
+        for (size_t i = size_; i > 0; --i) {
+            Elements()[i - 1].~E();
+        }
+    }
+    void DestroyBlock() override {
+        size_t bytes = ElementsOffset() + size_ * sizeof(E);
+        bool large = large_;
+        this->~ArrayControlBlock();
+        if (large) {
+            LargeObjects::Deallocate(this, bytes);
+        } else {
+            ::operator delete(static_cast<void*>(this));
+        }
+    }
+
+private:
+    ArrayControlBlock(size_t size, bool large) : size_(size), large_(large) {
+    }
+
+    static constexpr size_t ElementsOffset() {
+        return (sizeof(ArrayControlBlock) + alignof(E) - 1) / alignof(E) * alignof(E);
+    }
+
+    size_t size_;
+    bool large_;
+};
+
+template <typename T>
+class WeakPtr;
+
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
 template <typename T>
 class SharedPtr {
+public:
+    // `T` itself for objects, the element type for arrays (`SharedPtr<int[]>`)
+    using element_type = std::remove_extent_t<T>;
+
 private:
-    T* data_{};
+    element_type* data_{};
     ControlBlockBase* control_block_;
 
     template <typename Y>
     friend class SharedPtr;
 
+    template <typename Y>
+    friend class WeakPtr;
+
     template <typename Y, typename... Args>
     friend SharedPtr<Y> MakeShared(Args&&... args);
 
+    template <typename Y, typename... Args>
+    friend SharedPtr<Y> MakeSharedPooled(Args&&... args);
+
+    template <typename Y, typename Hash, typename KeyEqual>
+    friend class Interner;
+
+    friend class SharedBuffer;
+    friend class MappingControlBlock;
+
+    // Adopts a reference that the caller already holds on `control_block`
+    SharedPtr(ControlBlockBase* control_block, element_type* data) : data_(data), control_block_(control_block) {
+    }
+
+    // Arrays are released with `delete[]`
+    template <typename Y>
+    static ControlBlockBase* NewPtrBlock(Y* ptr) {
+        if constexpr (std::is_array_v<T>) {
+            return new ControlBlockArrayPtr<Y>(ptr);
+        } else {
+            return new ControlBlockPtr<Y>(ptr);
+        }
+    }
+
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
@@ -68,12 +452,12 @@ public:
     }
 
     template <typename Y>
-    explicit SharedPtr(Y* ptr) : data_(ptr), control_block_(new ControlBlockPtr<Y>(ptr)) {
+    explicit SharedPtr(Y* ptr) : data_(ptr), control_block_(NewPtrBlock(ptr)) {
     }
 
     SharedPtr(const SharedPtr& other) : data_(other.data_), control_block_(other.control_block_) {
         if (control_block_) {
-            ++control_block_->ref_cnt;
+            control_block_->IncRef();
         }
     }
     SharedPtr(SharedPtr&& other) : data_(other.data_), control_block_(other.control_block_) {
@@ -84,7 +468,7 @@ public:
     template <typename Y>
     SharedPtr(const SharedPtr<Y>& other) : data_(other.data_), control_block_(other.control_block_) {
         if (control_block_) {
-            ++control_block_->ref_cnt;
+            control_block_->IncRef();
         }
     }
     template <typename Y>
@@ -96,9 +480,11 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr)
+    SharedPtr(const SharedPtr<Y>& other, element_type* ptr)
             : data_(ptr), control_block_(other.control_block_) {
-        ++control_block_->ref_cnt;
+        if (control_block_) {
+            control_block_->IncRef();
+        }
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -110,7 +496,7 @@ public:
         data_ = other.data_;
         control_block_ = other.control_block_;
         if (control_block_) {
-            ++control_block_->ref_cnt;
+            control_block_->IncRef();
         }
 
         return *this;
@@ -132,11 +518,7 @@ public:
 
     ~SharedPtr() {
         if (control_block_) {
-            if (control_block_->ref_cnt == 1) {
-                delete control_block_;
-            } else {
-                --control_block_->ref_cnt;
-            }
+            control_block_->DecRef();
         }
     }
 
@@ -145,11 +527,7 @@ public:
 
     void Reset() {
         if (control_block_) {
-            if (control_block_->ref_cnt == 1) {
-                delete control_block_;
-            } else {
-                --control_block_->ref_cnt;
-            }
+            control_block_->DecRef();
         }
 
         data_ = nullptr;
@@ -159,15 +537,11 @@ public:
     template <typename Y>
     void Reset(Y* ptr) {
         if (control_block_) {
-            if (control_block_->ref_cnt == 1) {
-                delete control_block_;
-            } else {
-                --control_block_->ref_cnt;
-            }
+            control_block_->DecRef();
         }
 
         data_ = ptr;
-        control_block_ = new ControlBlockPtr<Y>(ptr);
+        control_block_ = NewPtrBlock(ptr);
     }
     void Swap(SharedPtr& other) {
         auto tmp = *this;
@@ -178,18 +552,23 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    element_type* Get() const {
         return data_;
     }
-    T& operator*() const {
+    std::add_lvalue_reference_t<element_type> operator*() const {
         return *data_;
     }
-    T* operator->() const {
+    element_type* operator->() const {
         return data_;
     }
+    std::add_lvalue_reference_t<element_type> operator[](std::ptrdiff_t index) const
+        requires std::is_array_v<T>
+    {
+        return data_[index];
+    }
     size_t UseCount() const {
         if (control_block_) {
-            return control_block_->ref_cnt;
+            return control_block_->UseCount();
         }
 
         return 0;
@@ -201,17 +580,211 @@ public:
             return false;
         }
     }
+
+    // Blocks until this is the only remaining reference
+    void WaitUntilUnique() const {
+        if (!control_block_) {
+            return;
+        }
+        control_block_->MarkObserved();
+        auto& word = ReleaseObservers::Instance().WaitWord(control_block_);
+        for (;;) {
+            uint32_t generation = word.load(std::memory_order_seq_cst);
+            if (control_block_->UseCount() <= 1) {
+                return;
+            }
+            word.wait(generation, std::memory_order_seq_cst);
+        }
+    }
+
+    // Calls `hook(remaining)` from the releasing thread whenever the count drops to one, and once
+    // more when it drops to zero, right before the object is destroyed
+    void OnLastRelease(ReleaseObservers::Hook hook) const {
+        if (control_block_) {
+            ReleaseObservers::Instance().Subscribe(control_block_, std::move(hook));
+        }
+    }
+
+    // Stops reference counting for the owned object: it is never destroyed, and copying or
+    // dropping pointers to it only reads the control block (see fork.h). WaitUntilUnique and
+    // OnLastRelease never fire for immortal objects.
+    void MakeImmortal() const {
+        if (control_block_) {
+            control_block_->MakeImmortal();
+        }
+    }
+    bool IsImmortal() const {
+        return control_block_ && control_block_->IsImmortal();
+    }
+
+    // Ordering by the owned control block rather than the stored pointer,
+    // so that aliasing pointers into the same object compare equivalent
+    template <typename Y>
+    bool OwnerBefore(const SharedPtr<Y>& other) const {
+        return std::less<ControlBlockBase*>{}(control_block_, other.control_block_);
+    }
+    size_t OwnerHash() const {
+        return std::hash<ControlBlockBase*>{}(control_block_);
+    }
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Comparisons (by the stored pointer, like std::shared_ptr)
+
 template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right);
+inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
+    return left.Get() == right.Get();
+}
+template <typename T>
+inline bool operator==(const SharedPtr<T>& left, std::nullptr_t) {
+    return !left;
+}
+
+template <typename T, typename U>
+inline std::strong_ordering operator<=>(const SharedPtr<T>& left, const SharedPtr<U>& right) {
+    return std::compare_three_way{}(left.Get(), right.Get());
+}
+template <typename T>
+inline std::strong_ordering operator<=>(const SharedPtr<T>& left, std::nullptr_t) {
+    return std::compare_three_way{}(left.Get(), static_cast<typename SharedPtr<T>::element_type*>(nullptr));
+}
+
+template <typename T>
+struct std::hash<SharedPtr<T>> {
+    size_t operator()(const SharedPtr<T>& ptr) const {
+        return std::hash<typename SharedPtr<T>::element_type*>{}(ptr.Get());
+    }
+};
+
+// Owner-based comparator for ordered containers, counterpart of std::owner_less
+struct OwnerLess {
+    template <typename T, typename U>
+    bool operator()(const SharedPtr<T>& left, const SharedPtr<U>& right) const {
+        return left.OwnerBefore(right);
+    }
+};
 
-// Allocate memory only once
+// Allocate memory only once.
+// `MakeShared<T[]>(size)` creates an array of value-initialized elements. Objects and arrays of
+// at least LargeObjects' threshold are mapped directly and unmapped on release.
 template <typename Y, typename... Args>
 SharedPtr<Y> MakeShared(Args&&... args) {
     SharedPtr<Y> shared_ptr;
-    auto block = new ControlBlockHolder<Y>(std::forward<Args>(args)...);
-    shared_ptr.control_block_ = block;
-    shared_ptr.data_ = block->GetRawPointer();
+    if constexpr (std::is_unbounded_array_v<Y>) {
+        static_assert(sizeof...(Args) == 1, "MakeShared<T[]> takes the element count");
+        auto block = ArrayControlBlock<std::remove_extent_t<Y>>::Create(static_cast<size_t>(args)...);
+        shared_ptr.control_block_ = block;
+        shared_ptr.data_ = block->Elements();
+    } else {
+        ControlBlockHolder<Y>* block;
+        if constexpr (sizeof(ControlBlockHolder<Y>) >= LargeObjects::kMinSize &&
+                      alignof(Y) <= LargeObjects::kPageSize) {
+            if (LargeObjects::IsLarge(sizeof(ControlBlockHolder<Y>))) {
+                block = new LargeControlBlockHolder<Y>(std::forward<Args>(args)...);
+            } else {
+                block = new ControlBlockHolder<Y>(std::forward<Args>(args)...);
+            }
+        } else {
+            block = new ControlBlockHolder<Y>(std::forward<Args>(args)...);
+        }
+        shared_ptr.control_block_ = block;
+        shared_ptr.data_ = block->GetRawPointer();
+    }
     return shared_ptr;
 }
+
+// https://en.cppreference.com/w/cpp/memory/weak_ptr
+template <typename T>
+class WeakPtr {
+private:
+    std::remove_extent_t<T>* data_{};
+    ControlBlockBase* control_block_{};
+
+    template <typename Y>
+    friend class WeakPtr;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    WeakPtr() = default;
+
+    template <typename Y>
+    WeakPtr(const SharedPtr<Y>& other) : data_(other.data_), control_block_(other.control_block_) {
+        if (control_block_) {
+            control_block_->IncWeak();
+        }
+    }
+
+    WeakPtr(const WeakPtr& other) : data_(other.data_), control_block_(other.control_block_) {
+        if (control_block_) {
+            control_block_->IncWeak();
+        }
+    }
+    WeakPtr(WeakPtr&& other) : data_(other.data_), control_block_(other.control_block_) {
+        other.data_ = nullptr;
+        other.control_block_ = nullptr;
+    }
+
+    template <typename Y>
+    WeakPtr(const WeakPtr<Y>& other) : data_(other.data_), control_block_(other.control_block_) {
+        if (control_block_) {
+            control_block_->IncWeak();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    WeakPtr& operator=(const WeakPtr& other) {
+        if (this != &other) {
+            WeakPtr(other).Swap(*this);
+        }
+        return *this;
+    }
+    WeakPtr& operator=(WeakPtr&& other) {
+        WeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~WeakPtr() {
+        if (control_block_) {
+            control_block_->DecWeak();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        WeakPtr().Swap(*this);
+    }
+    void Swap(WeakPtr& other) {
+        std::swap(data_, other.data_);
+        std::swap(control_block_, other.control_block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const {
+        if (control_block_) {
+            return control_block_->UseCount();
+        }
+
+        return 0;
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    SharedPtr<T> Lock() const {
+        if (control_block_ && control_block_->TryIncRef()) {
+            return SharedPtr<T>(control_block_, data_);
+        }
+
+        return nullptr;
+    }
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "concurrent_map.h"
+#include "shared.h"
+
+// Sharded cache of SharedPtr values with CLOCK (approximate LRU) and TTL eviction.
+// Hits go through the lock-free index of ConcurrentSharedMap and only set the entry's
+// reference bit; misses and insertions lock one shard. The cache never frees a value on its
+// own: eviction drops the cache's strong reference and keeps a weak one, so a value that
+// callers still hold is found again by `Get` and re-admitted.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class SharedCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        // Misses served from a value that was evicted but still held by someone
+        size_t resurrections = 0;
+    };
+
+    // A zero `ttl` disables expiration
+    explicit SharedCache(size_t capacity, Clock::duration ttl = Clock::duration::zero(),
+                         size_t shard_count = 16)
+            : ttl_(ttl), index_(shard_count), shard_count_(RoundUpToPowerOfTwo(shard_count)),
+              shards_(new Shard[shard_count_]) {
+        shard_capacity_ = (capacity + shard_count_ - 1) / shard_count_;
+        if (shard_capacity_ == 0) {
+            shard_capacity_ = 1;
+        }
+    }
+
+    SharedCache(const SharedCache&) = delete;
+    SharedCache& operator=(const SharedCache&) = delete;
+
+    SharedPtr<V> Get(const K& key) {
+        size_t hash = Hash{}(key);
+        Shard& shard = ShardFor(hash);
+
+        auto entry = index_.Find(key);
+        if (entry && !Expired(*entry, Clock::now())) {
+            // Avoid dirtying the line when the bit is already set
+            if (!entry->referenced.load(std::memory_order_relaxed)) {
+                entry->referenced.store(true, std::memory_order_relaxed);
+            }
+            shard.hits.fetch_add(1, std::memory_order_relaxed);
+            return entry->value;
+        }
+
+        std::lock_guard lock(shard.mutex);
+        auto ghost = shard.ghosts.find(key);
+        if (ghost != shard.ghosts.end()) {
+            SharedPtr<V> value = ghost->second.Lock();
+            shard.ghosts.erase(ghost);
+            if (value) {
+                shard.resurrections.fetch_add(1, std::memory_order_relaxed);
+                InsertLocked(shard, key, value);
+                return value;
+            }
+        }
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    void Put(const K& key, SharedPtr<V> value) {
+        Shard& shard = ShardFor(Hash{}(key));
+        std::lock_guard lock(shard.mutex);
+        shard.ghosts.erase(key);
+        InsertLocked(shard, key, std::move(value));
+    }
+
+    // Returns the cached value or stores the one produced by `make()`
+    template <typename F>
+    SharedPtr<V> GetOrCreate(const K& key, F&& make) {
+        if (auto value = Get(key)) {
+            return value;
+        }
+        SharedPtr<V> value = make();
+        Put(key, value);
+        return value;
+    }
+
+    bool Erase(const K& key) {
+        Shard& shard = ShardFor(Hash{}(key));
+        std::lock_guard lock(shard.mutex);
+        shard.ghosts.erase(key);
+        // The ring entry becomes stale and is dropped when the clock hand reaches it
+        return static_cast<bool>(index_.Erase(key));
+    }
+
+    // Drops up to `max_entries` entries whose value is held by nobody but the cache,
+    // returns the number of dropped entries. The ring is compacted in order, so the clock hand
+    // keeps its place.
+    size_t ShedUnused(size_t max_entries = SIZE_MAX) {
+        size_t shed = 0;
+        for (size_t i = 0; i < shard_count_ && shed < max_entries; ++i) {
+            Shard& shard = shards_[i];
+            std::lock_guard lock(shard.mutex);
+            size_t kept = 0;
+            size_t hand = 0;
+            for (size_t j = 0; j < shard.ring.size(); ++j) {
+                SharedPtr<Entry>& entry = shard.ring[j];
+                bool stale = index_.Find(entry->key) != entry;
+                bool drop = shed < max_entries && (stale || entry->value.UseCount() == 1);
+                if (drop && !stale) {
+                    index_.Erase(entry->key);
+                    shard.evictions.fetch_add(1, std::memory_order_relaxed);
+                    ++shed;
+                }
+                if (!drop) {
+                    hand += j < shard.hand ? 1 : 0;
+                    if (kept != j) {
+                        shard.ring[kept] = std::move(entry);
+                    }
+                    ++kept;
+                }
+            }
+            shard.ring.resize(kept);
+            shard.hand = hand;
+        }
+        return shed;
+    }
+
+    // Entries whose value is held by nobody but the cache, i.e. what ShedUnused can drop
+    size_t CountUnused() {
+        size_t unused = 0;
+        for (size_t i = 0; i < shard_count_; ++i) {
+            Shard& shard = shards_[i];
+            std::lock_guard lock(shard.mutex);
+            for (const auto& entry : shard.ring) {
+                if (index_.Find(entry->key) == entry && entry->value.UseCount() == 1) {
+                    ++unused;
+                }
+            }
+        }
+        return unused;
+    }
+
+    // Entries currently admitted, including expired ones not yet swept
+    size_t Size() const {
+        return index_.Size();
+    }
+
+    Stats GetStats() const {
+        Stats stats;
+        for (size_t i = 0; i < shard_count_; ++i) {
+            stats.hits += shards_[i].hits.load(std::memory_order_relaxed);
+            stats.misses += shards_[i].misses.load(std::memory_order_relaxed);
+            stats.evictions += shards_[i].evictions.load(std::memory_order_relaxed);
+            stats.resurrections += shards_[i].resurrections.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+private:
+    struct Entry {
+        Entry(const K& key, SharedPtr<V> value, Clock::time_point expires_at)
+                : key(key), value(std::move(value)), expires_at(expires_at) {
+        }
+
+        K key;
+        SharedPtr<V> value;
+        Clock::time_point expires_at;
+        std::atomic<bool> referenced{false};
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        // CLOCK ring, may contain entries already replaced or erased in the index
+        std::vector<SharedPtr<Entry>> ring;
+        size_t hand = 0;
+        // Evicted values, reachable while somebody else still holds them
+        std::unordered_map<K, WeakPtr<V>, Hash> ghosts;
+
+        std::atomic<size_t> hits{0};
+        std::atomic<size_t> misses{0};
+        std::atomic<size_t> evictions{0};
+        std::atomic<size_t> resurrections{0};
+    };
+
+    static size_t RoundUpToPowerOfTwo(size_t n) {
+        size_t result = 1;
+        while (result < n) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    Shard& ShardFor(size_t hash) const {
+        return shards_[(static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ULL >> 40) & (shard_count_ - 1)];
+    }
+
+    bool Expired(const Entry& entry, Clock::time_point now) const {
+        return ttl_ != Clock::duration::zero() && entry.expires_at <= now;
+    }
+
+    void InsertLocked(Shard& shard, const K& key, SharedPtr<V> value) {
+        auto now = Clock::now();
+        auto entry = MakeShared<Entry>(key, std::move(value), now + ttl_);
+        // A replaced entry stays in the ring until the hand drops it
+        index_.InsertOrAssign(key, entry);
+        if (shard.ring.size() < shard_capacity_) {
+            shard.ring.push_back(std::move(entry));
+            return;
+        }
+        // The new entry takes the victim's slot, right behind the hand, so it is looked at last
+        size_t slot = EvictOneLocked(shard, now);
+        shard.ring[slot] = std::move(entry);
+        shard.hand = slot + 1;
+    }
+
+    // Advances the clock hand to the next entry it may drop, drops it and returns its slot for
+    // the caller to fill; removing it instead would reorder the ring
+    size_t EvictOneLocked(Shard& shard, Clock::time_point now) {
+        for (;;) {
+            if (shard.hand >= shard.ring.size()) {
+                shard.hand = 0;
+            }
+            SharedPtr<Entry>& entry = shard.ring[shard.hand];
+
+            bool stale = index_.Find(entry->key) != entry;
+            if (!stale && !Expired(*entry, now) && entry->referenced.load(std::memory_order_relaxed)) {
+                entry->referenced.store(false, std::memory_order_relaxed);
+                ++shard.hand;
+                continue;
+            }
+
+            if (!stale) {
+                index_.Erase(entry->key);
+                shard.evictions.fetch_add(1, std::memory_order_relaxed);
+                // Expired values are never handed out again
+                if (!Expired(*entry, now) && entry->value.UseCount() > 1) {
+                    RememberLocked(shard, entry->key, entry->value);
+                }
+            }
+            entry = nullptr;
+            return shard.hand;
+        }
+    }
+
+    void RememberLocked(Shard& shard, const K& key, const SharedPtr<V>& value) {
+        if (shard.ghosts.size() >= shard_capacity_) {
+            for (auto it = shard.ghosts.begin(); it != shard.ghosts.end();) {
+                it = it->second.Expired() ? shard.ghosts.erase(it) : std::next(it);
+            }
+        }
+        if (shard.ghosts.size() >= shard_capacity_) {
+            shard.ghosts.erase(shard.ghosts.begin());
+        }
+        shard.ghosts.insert_or_assign(key, WeakPtr<V>(value));
+    }
+
+    Clock::duration ttl_;
+    ConcurrentSharedMap<K, Entry, Hash> index_;
+    size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_capacity_;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "shared.h"
+
+template <typename Signature>
+class SharedFunction;
+
+// Reference-counted type-erased callable. The callable lives in a ControlBlockHolder, so copying
+// a SharedFunction only bumps the reference count and every copy shares the captured state.
+// The handle caches the invoker, so a call is one indirect jump with the object pointer taken
+// straight from the embedded SharedPtr. Calling an empty SharedFunction throws
+// std::bad_function_call, like std::function; the empty invoker does that, so the check costs
+// nothing on the call path.
+template <typename R, typename... Args>
+class SharedFunction<R(Args...)> {
+public:
+    SharedFunction() = default;
+    SharedFunction(std::nullptr_t) {
+    }
+
+    template <typename F>
+        requires(!std::is_same_v<std::decay_t<F>, SharedFunction> &&
+                 std::is_invocable_r_v<R, std::decay_t<F>&, Args...>)
+    SharedFunction(F&& f)
+            : invoke_(&Invoke<std::decay_t<F>>), callable_(MakeShared<std::decay_t<F>>(std::forward<F>(f))) {
+    }
+
+    SharedFunction(const SharedFunction&) = default;
+    SharedFunction& operator=(const SharedFunction&) = default;
+    // Moved-from functions are empty
+    SharedFunction(SharedFunction&& other) noexcept
+            : invoke_(std::exchange(other.invoke_, &InvokeEmpty)), callable_(std::move(other.callable_)) {
+    }
+    SharedFunction& operator=(SharedFunction&& other) noexcept {
+        invoke_ = std::exchange(other.invoke_, &InvokeEmpty);
+        callable_ = std::move(other.callable_);
+        return *this;
+    }
+
+    R operator()(Args... args) const {
+        return invoke_(callable_.Get(), std::forward<Args>(args)...);
+    }
+
+    size_t UseCount() const {
+        return callable_.UseCount();
+    }
+    explicit operator bool() const {
+        return static_cast<bool>(callable_);
+    }
+
+private:
+    template <typename F>
+    static R Invoke(void* callable, Args... args) {
+        return (*static_cast<F*>(callable))(std::forward<Args>(args)...);
+    }
+
+    static R InvokeEmpty(void*, Args...) {
+        throw std::bad_function_call();
+    }
+
+    R (*invoke_)(void*, Args...) = &InvokeEmpty;
+    SharedPtr<void> callable_;
+};
+
+// Single allocation: the callable is constructed in place inside its control block
+template <typename Signature, typename F>
+SharedFunction<Signature> MakeSharedFunction(F&& f) {
+    return SharedFunction<Signature>(std::forward<F>(f));
+}
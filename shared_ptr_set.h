@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include "shared.h"
+
+// Open-addressing containers keyed by the pointer stored in a SharedPtr.
+// Probing only reads a dense array of raw pointers; the owning SharedPtr-s live in a parallel
+// array that is touched once the slot is found, so lookups never load a control block.
+// Linear probing with backward-shift deletion, so there are no tombstones.
+template <typename T, typename V>
+class SharedPtrMap {
+public:
+    explicit SharedPtrMap(size_t capacity = 16) {
+        Allocate(RoundUpToPowerOfTwo(capacity < 2 ? 2 : capacity));
+    }
+
+    SharedPtrMap(SharedPtrMap&&) = default;
+    SharedPtrMap& operator=(SharedPtrMap&&) = default;
+
+    // Returns the value for `key`, inserting a default-constructed one if absent. Null pointers
+    // mark empty slots, so a null key throws std::invalid_argument; LocateOrInsert asserts the
+    // same for every other caller.
+    V& operator[](const SharedPtr<T>& key) {
+        if (!key) {
+            throw std::invalid_argument("SharedPtrMap: null key");
+        }
+        return entries_[LocateOrInsert(key)].value;
+    }
+
+    // Returns whether the key was inserted; an existing value is left untouched
+    bool Insert(const SharedPtr<T>& key, V value) {
+        if (!key) {
+            return false;
+        }
+        size_t size = size_;
+        size_t index = LocateOrInsert(key);
+        if (size == size_) {
+            return false;
+        }
+        entries_[index].value = std::move(value);
+        return true;
+    }
+
+    V* Find(const T* key) {
+        size_t index = Locate(key);
+        return index == kNotFound ? nullptr : &entries_[index].value;
+    }
+    const V* Find(const T* key) const {
+        size_t index = Locate(key);
+        return index == kNotFound ? nullptr : &entries_[index].value;
+    }
+    V* Find(const SharedPtr<T>& key) {
+        return Find(key.Get());
+    }
+    const V* Find(const SharedPtr<T>& key) const {
+        return Find(key.Get());
+    }
+
+    bool Contains(const T* key) const {
+        return Locate(key) != kNotFound;
+    }
+    bool Contains(const SharedPtr<T>& key) const {
+        return Contains(key.Get());
+    }
+
+    bool Erase(const T* key) {
+        size_t index = Locate(key);
+        if (index == kNotFound) {
+            return false;
+        }
+
+        // Shift back every following entry of the cluster that is not at its home slot
+        size_t hole = index;
+        for (size_t i = (hole + 1) & mask_; keys_[i]; i = (i + 1) & mask_) {
+            size_t home = Slot(keys_[i]);
+            if (((i - home) & mask_) >= ((i - hole) & mask_)) {
+                keys_[hole] = keys_[i];
+                entries_[hole] = std::move(entries_[i]);
+                hole = i;
+            }
+        }
+        keys_[hole] = nullptr;
+        entries_[hole] = Entry{};
+        --size_;
+        return true;
+    }
+    bool Erase(const SharedPtr<T>& key) {
+        return Erase(key.Get());
+    }
+
+    // Calls `f(const SharedPtr<T>&, V&)` for every entry
+    template <typename F>
+    void ForEach(F&& f) {
+        for (size_t i = 0; i <= mask_; ++i) {
+            if (keys_[i]) {
+                f(entries_[i].owner, entries_[i].value);
+            }
+        }
+    }
+
+    void Clear() {
+        Allocate(mask_ + 1);
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+private:
+    struct Entry {
+        SharedPtr<T> owner;
+        [[no_unique_address]] V value{};
+    };
+
+    static constexpr size_t kNotFound = SIZE_MAX;
+
+    static size_t RoundUpToPowerOfTwo(size_t n) {
+        size_t result = 1;
+        while (result < n) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    // Fibonacci hashing: the high bits of the product are well mixed even for aligned pointers
+    size_t Slot(const T* key) const {
+        uint64_t h = reinterpret_cast<uintptr_t>(key) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h >> shift_);
+    }
+
+    void Allocate(size_t capacity) {
+        keys_.reset(new const T*[capacity]());
+        entries_.reset(new Entry[capacity]);
+        mask_ = capacity - 1;
+        shift_ = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) {
+            --shift_;
+        }
+        size_ = 0;
+    }
+
+    size_t Locate(const T* key) const {
+        if (!key) {
+            return kNotFound;
+        }
+        for (size_t i = Slot(key);; i = (i + 1) & mask_) {
+            if (keys_[i] == key) {
+                return i;
+            }
+            if (!keys_[i]) {
+                return kNotFound;
+            }
+        }
+    }
+
+    size_t LocateOrInsert(const SharedPtr<T>& key) {
+        // Null pointers mark empty slots and cannot be stored
+        assert(key);
+        if ((size_ + 1) * 8 > (mask_ + 1) * 7) {
+            Grow();
+        }
+        for (size_t i = Slot(key.Get());; i = (i + 1) & mask_) {
+            if (keys_[i] == key.Get()) {
+                return i;
+            }
+            if (!keys_[i]) {
+                keys_[i] = key.Get();
+                entries_[i].owner = key;
+                ++size_;
+                return i;
+            }
+        }
+    }
+
+    void Grow() {
+        auto keys = std::move(keys_);
+        auto entries = std::move(entries_);
+        size_t capacity = mask_ + 1;
+        Allocate(capacity * 2);
+        for (size_t i = 0; i < capacity; ++i) {
+            if (!keys[i]) {
+                continue;
+            }
+            size_t j = Slot(keys[i]);
+            while (keys_[j]) {
+                j = (j + 1) & mask_;
+            }
+            keys_[j] = keys[i];
+            entries_[j] = std::move(entries[i]);
+            ++size_;
+        }
+    }
+
+    std::unique_ptr<const T*[]> keys_;
+    std::unique_ptr<Entry[]> entries_;
+    size_t mask_ = 0;
+    size_t shift_ = 64;
+    size_t size_ = 0;
+};
+
+template <typename T>
+class SharedPtrSet {
+public:
+    explicit SharedPtrSet(size_t capacity = 16) : map_(capacity) {
+    }
+
+    bool Insert(const SharedPtr<T>& key) {
+        return map_.Insert(key, Unit{});
+    }
+    bool Contains(const T* key) const {
+        return map_.Contains(key);
+    }
+    bool Contains(const SharedPtr<T>& key) const {
+        return map_.Contains(key);
+    }
+    bool Erase(const T* key) {
+        return map_.Erase(key);
+    }
+    bool Erase(const SharedPtr<T>& key) {
+        return map_.Erase(key);
+    }
+
+    // Calls `f(const SharedPtr<T>&)` for every element
+    template <typename F>
+    void ForEach(F&& f) {
+        map_.ForEach([&f](const SharedPtr<T>& key, auto&) { f(key); });
+    }
+
+    void Clear() {
+        map_.Clear();
+    }
+    size_t Size() const {
+        return map_.Size();
+    }
+    bool Empty() const {
+        return map_.Empty();
+    }
+
+private:
+    struct Unit {};
+
+    SharedPtrMap<T, Unit> map_;
+};
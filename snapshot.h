@@ -0,0 +1,199 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+#include "offset_ptr.h"
+#include "shared.h"
+
+// Warm-start snapshots: objects are laid out position-independently in a file that is mapped
+// and used in place, without deserialization.
+// Snapshot objects are plain data linked with OffsetPtr: they must be trivially destructible
+// and survive being moved by memcpy. A file is only valid for the build that wrote it (native
+// layout and byte order).
+struct SnapshotHeader {
+    static constexpr uint64_t kMagic = 0x31706e736d5f796d;  // "my_msnp1"
+    static constexpr uint32_t kVersion = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t root_count;
+    uint64_t size;
+    // Array of root_count object offsets
+    uint64_t roots;
+};
+
+class SnapshotBuilder {
+public:
+    SnapshotBuilder() : bytes_(sizeof(SnapshotHeader)) {
+    }
+
+    // Constructs an object in the image and returns its offset
+    template <typename T, typename... Args>
+    size_t Emplace(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "snapshot objects are never destroyed");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned snapshot object");
+        size_t offset = (bytes_.size() + alignof(T) - 1) / alignof(T) * alignof(T);
+        bytes_.resize(offset + sizeof(T));
+        new (bytes_.data() + offset) T(std::forward<Args>(args)...);
+        return offset;
+    }
+
+    // Valid until the next Emplace; link objects by assigning At() pointers to OffsetPtr fields
+    template <typename T>
+    T* At(size_t offset) {
+        return reinterpret_cast<T*>(bytes_.data() + offset);
+    }
+
+    // Returns the root's index
+    size_t AddRoot(size_t offset) {
+        roots_.push_back(offset);
+        return roots_.size() - 1;
+    }
+
+    // Writes to a temporary file and renames it over `path`, so readers never map a partial
+    // snapshot; false on error, see errno
+    bool WriteTo(const std::string& path) const {
+        std::vector<std::byte> image = bytes_;
+        size_t roots = (image.size() + alignof(uint64_t) - 1) / alignof(uint64_t) * alignof(uint64_t);
+        image.resize(roots + roots_.size() * sizeof(uint64_t));
+        std::memcpy(image.data() + roots, roots_.data(), roots_.size() * sizeof(uint64_t));
+        SnapshotHeader header{SnapshotHeader::kMagic, SnapshotHeader::kVersion, static_cast<uint32_t>(roots_.size()),
+                              image.size(), roots};
+        std::memcpy(image.data(), &header, sizeof(header));
+
+        std::string temporary = path + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        size_t written = 0;
+        while (written < image.size()) {
+            ssize_t count = ::write(fd, image.data() + written, image.size() - written);
+            if (count < 0 && errno != EINTR) {
+                break;
+            }
+            written += count > 0 ? static_cast<size_t>(count) : 0;
+        }
+        bool ok = written == image.size() && ::fsync(fd) == 0;
+        int error = errno;
+        ::close(fd);
+        if (ok && ::rename(temporary.c_str(), path.c_str()) == 0) {
+            return true;
+        }
+        error = ok ? errno : error;
+        ::unlink(temporary.c_str());
+        errno = error;
+        return false;
+    }
+
+private:
+    std::vector<std::byte> bytes_;
+    std::vector<uint64_t> roots_;
+};
+
+// Mapped snapshot. Roots and objects come out as SharedPtr<const T> aliasing the mapping, whose
+// control block is made immortal: handing out and dropping them never writes to memory, and the
+// file stays mapped for the rest of the process.
+class Snapshot {
+public:
+    Snapshot() = default;
+
+    // Invalid snapshot on error (see errno, EINVAL for malformed files, including roots that do
+    // not point between the header and the root table)
+    static Snapshot Open(const std::string& path, MapFlags flags = MapFlags::kWillNeed) {
+        size_t size = 0;
+        auto mapping = MapShared(path, flags, &size);
+        if (!mapping) {
+            return Snapshot();
+        }
+        SnapshotHeader header;
+        std::memcpy(&header, mapping.Get(), std::min(size, sizeof(header)));
+        if (size < sizeof(header) || header.magic != SnapshotHeader::kMagic ||
+            header.version != SnapshotHeader::kVersion || header.size != size || header.roots > size ||
+            (size - header.roots) / sizeof(uint64_t) < header.root_count) {
+            errno = EINVAL;
+            return Snapshot();
+        }
+        for (uint32_t index = 0; index < header.root_count; ++index) {
+            uint64_t offset;
+            std::memcpy(&offset, mapping.Get() + header.roots + index * sizeof(uint64_t), sizeof(offset));
+            if (offset < sizeof(header) || offset >= header.roots) {
+                errno = EINVAL;
+                return Snapshot();
+            }
+        }
+        mapping.MakeImmortal();
+        return Snapshot(std::move(mapping), size);
+    }
+
+    explicit operator bool() const {
+        return static_cast<bool>(mapping_);
+    }
+
+    size_t RootCount() const {
+        return Header()->root_count;
+    }
+
+    // The caller knows the root's type; the file does not record it. Empty pointer for an index
+    // past RootCount() or when a T at the root's offset would be misaligned or run past the end.
+    template <typename T>
+    SharedPtr<const T> Root(size_t index) const {
+        if (!mapping_ || index >= RootCount()) {
+            return nullptr;
+        }
+        uint64_t offset;
+        std::memcpy(&offset, mapping_.Get() + Header()->roots + index * sizeof(uint64_t), sizeof(offset));
+        if (sizeof(T) > size_ || offset > size_ - sizeof(T) || offset % alignof(T) != 0) {
+            return nullptr;
+        }
+        return Share(reinterpret_cast<const T*>(mapping_.Get() + offset));
+    }
+
+    // SharedPtr to any object inside the snapshot, e.g. one reached through an OffsetPtr
+    template <typename T>
+    SharedPtr<const T> Share(const T* object) const {
+        assert(Contains(object));
+        return SharedPtr<const T>(mapping_, object);
+    }
+
+    bool Contains(const void* ptr) const {
+        auto byte = static_cast<const std::byte*>(ptr);
+        return mapping_ && byte >= mapping_.Get() && byte < mapping_.Get() + size_;
+    }
+
+    // Copy-on-mutate: objects still in the snapshot, or shared with others, are first copied into
+    // a MakeShared block that replaces `ptr`. OffsetPtr fields of the copy keep pointing into the
+    // snapshot.
+    template <typename T>
+    T& MakeMutable(SharedPtr<const T>& ptr) const {
+        if (Contains(ptr.Get()) || ptr.UseCount() != 1) {
+            ptr = MakeShared<T>(*ptr);
+        }
+        return const_cast<T&>(*ptr);
+    }
+
+private:
+    Snapshot(SharedPtr<const std::byte[]> mapping, size_t size) : mapping_(std::move(mapping)), size_(size) {
+    }
+
+    const SnapshotHeader* Header() const {
+        return reinterpret_cast<const SnapshotHeader*>(mapping_.Get());
+    }
+
+    SharedPtr<const std::byte[]> mapping_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "shared.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reader-writer lock policies. All of them model the standard SharedMutex requirements
+// (lock/unlock/lock_shared/unlock_shared), so std::shared_mutex is a policy as well.
+
+// Single word lock for short critical sections
+class SpinRWLock {
+public:
+    void lock() {
+        uint32_t expected = 0;
+        for (size_t spins = 0;
+             !state_.compare_exchange_weak(expected, kWriter, std::memory_order_acquire,
+                                           std::memory_order_relaxed);
+             ++spins) {
+            expected = 0;
+            Backoff(spins);
+        }
+    }
+    void unlock() {
+        state_.store(0, std::memory_order_release);
+    }
+
+    void lock_shared() {
+        for (size_t spins = 0;; ++spins) {
+            uint32_t state = state_.load(std::memory_order_relaxed);
+            if (!(state & kWriter) &&
+                state_.compare_exchange_weak(state, state + 1, std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+                return;
+            }
+            Backoff(spins);
+        }
+    }
+    void unlock_shared() {
+        state_.fetch_sub(1, std::memory_order_release);
+    }
+
+private:
+    static constexpr uint32_t kWriter = 1u << 31;
+
+    static void Backoff(size_t spins) {
+        if (spins >= 64) {
+            std::this_thread::yield();
+        }
+    }
+
+    std::atomic<uint32_t> state_{0};
+};
+
+// Readers only touch their own cache line, writers scan all of them.
+// Threads are spread over the slots round-robin, which approximates one slot per core
+// without having to remember the CPU a reader locked on.
+class PerCoreRWLock {
+public:
+    static constexpr size_t kSlots = 64;
+
+    void lock() {
+        while (writer_.exchange(true, std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        for (auto& slot : slots_) {
+            while (slot.readers.load(std::memory_order_seq_cst) != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    void unlock() {
+        writer_.store(false, std::memory_order_release);
+    }
+
+    void lock_shared() {
+        Slot& slot = slots_[SlotIndex()];
+        for (;;) {
+            slot.readers.fetch_add(1, std::memory_order_seq_cst);
+            if (!writer_.load(std::memory_order_seq_cst)) {
+                return;
+            }
+            slot.readers.fetch_sub(1, std::memory_order_release);
+            while (writer_.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    void unlock_shared() {
+        slots_[SlotIndex()].readers.fetch_sub(1, std::memory_order_release);
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> readers{0};
+    };
+
+    static size_t SlotIndex() {
+        static std::atomic<size_t> next{0};
+        static thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % kSlots;
+        return index;
+    }
+
+    alignas(64) std::atomic<bool> writer_{false};
+    Slot slots_[kSlots];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// SharedSynchronized
+
+// Shared handle to a T guarded by a reader-writer lock. The lock and the object live in the
+// same ControlBlockHolder, so one allocation replaces a SharedPtr<T> + SharedPtr<mutex> pair.
+template <typename T, typename Lock = std::shared_mutex>
+class SharedSynchronized {
+private:
+    struct State {
+        template <typename... Args>
+        explicit State(Args&&... args) : value(std::forward<Args>(args)...) {
+        }
+
+        Lock lock;
+        T value;
+    };
+
+    template <typename Y, typename L, typename... Args>
+    friend SharedSynchronized<Y, L> MakeSharedSynchronized(Args&&... args);
+
+    explicit SharedSynchronized(SharedPtr<State> state) : state_(std::move(state)) {
+    }
+
+    SharedPtr<State> state_;
+
+public:
+    SharedSynchronized() = default;
+
+    // Calls `f(const T&)` under a shared lock and returns its result
+    template <typename F>
+    decltype(auto) WithRLock(F&& f) const {
+        std::shared_lock lock(state_->lock);
+        return std::forward<F>(f)(std::as_const(state_->value));
+    }
+
+    // Calls `f(T&)` under an exclusive lock and returns its result
+    template <typename F>
+    decltype(auto) WithWLock(F&& f) const {
+        std::unique_lock lock(state_->lock);
+        return std::forward<F>(f)(state_->value);
+    }
+
+    size_t UseCount() const {
+        return state_.UseCount();
+    }
+    explicit operator bool() const {
+        return static_cast<bool>(state_);
+    }
+};
+
+template <typename T, typename Lock = std::shared_mutex, typename... Args>
+SharedSynchronized<T, Lock> MakeSharedSynchronized(Args&&... args) {
+    using State = typename SharedSynchronized<T, Lock>::State;
+    return SharedSynchronized<T, Lock>(MakeShared<State>(std::forward<Args>(args)...));
+}
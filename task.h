@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "block_pool.h"
+#include "shared.h"
+
+// Eager coroutine task whose frame is its own control block.
+// The promise derives from ControlBlockBase, so SharedTask copies are plain reference count
+// bumps and any number of awaiters may hold the result. The running coroutine owns one
+// reference until it finishes; the frame is freed when the last one goes. Frames are allocated
+// from BlockPool through the promise's operator new.
+template <typename T>
+class SharedTask {
+    static_assert(!std::is_void_v<T>, "SharedTask needs a result type");
+
+public:
+    class promise_type : public ControlBlockBase {
+    public:
+        static void* operator new(size_t size) {
+            return BlockPool::Allocate(size);
+        }
+        static void operator delete(void* ptr, size_t size) {
+            BlockPool::Deallocate(ptr, size);
+        }
+
+        SharedTask get_return_object() {
+            // The reference the block starts with belongs to the coroutine itself
+            IncRef();
+            return SharedTask(this);
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        auto final_suspend() noexcept {
+            struct FinalAwaiter {
+                bool await_ready() noexcept {
+                    return false;
+                }
+                void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    promise_type& promise = handle.promise();
+                    void* waiters = promise.waiters_.exchange(promise.Done(), std::memory_order_acq_rel);
+                    promise.done_.store(true, std::memory_order_release);
+                    promise.done_.notify_all();
+                    for (auto waiter = static_cast<Waiter*>(waiters); waiter;) {
+                        Waiter* next = waiter->next;
+                        waiter->handle.resume();
+                        waiter = next;
+                    }
+                    // May free the frame, which is fine at the final suspension point
+                    promise.DecRef();
+                }
+                void await_resume() noexcept {
+                }
+            };
+            return FinalAwaiter{};
+        }
+
+        template <typename U>
+        void return_value(U&& value) {
+            result_.emplace(std::forward<U>(value));
+        }
+
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+
+        // The result stays in the frame until the block is freed
+        void DestroyObject() override {
+        }
+        void DestroyBlock() override {
+            std::coroutine_handle<promise_type>::from_promise(*this).destroy();
+        }
+
+    private:
+        friend class SharedTask;
+
+        struct Waiter {
+            std::coroutine_handle<> handle;
+            Waiter* next = nullptr;
+        };
+
+        void* Done() {
+            return this;
+        }
+
+        // Pushes the waiter unless the task is already done
+        bool AddWaiter(Waiter* waiter) {
+            void* head = waiters_.load(std::memory_order_acquire);
+            do {
+                if (head == Done()) {
+                    return false;
+                }
+                waiter->next = static_cast<Waiter*>(head);
+            } while (!waiters_.compare_exchange_weak(head, waiter, std::memory_order_acq_rel,
+                                                     std::memory_order_acquire));
+            return true;
+        }
+
+        // Stack of suspended awaiters, or `Done()` once the result is set
+        std::atomic<void*> waiters_{nullptr};
+        std::atomic<bool> done_{false};
+        std::optional<T> result_;
+    };
+
+    SharedTask() = default;
+
+    SharedTask(const SharedTask& other) : promise_(other.promise_) {
+        if (promise_) {
+            promise_->IncRef();
+        }
+    }
+    SharedTask(SharedTask&& other) : promise_(std::exchange(other.promise_, nullptr)) {
+    }
+
+    SharedTask& operator=(SharedTask other) {
+        std::swap(promise_, other.promise_);
+        return *this;
+    }
+
+    ~SharedTask() {
+        if (promise_) {
+            promise_->DecRef();
+        }
+    }
+
+    bool IsReady() const {
+        return promise_->done_.load(std::memory_order_acquire);
+    }
+
+    // Blocks the calling thread until the coroutine finishes
+    const T& Get() const {
+        promise_->done_.wait(false, std::memory_order_acquire);
+        return *promise_->result_;
+    }
+
+    auto operator co_await() const noexcept {
+        struct Awaiter {
+            bool await_ready() noexcept {
+                return promise->done_.load(std::memory_order_acquire);
+            }
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                waiter.handle = handle;
+                return promise->AddWaiter(&waiter);
+            }
+            const T& await_resume() noexcept {
+                return *promise->result_;
+            }
+
+            promise_type* promise;
+            typename promise_type::Waiter waiter;
+        };
+        return Awaiter{promise_, {}};
+    }
+
+    size_t UseCount() const {
+        return promise_ ? promise_->UseCount() : 0;
+    }
+    explicit operator bool() const {
+        return promise_ != nullptr;
+    }
+
+private:
+    explicit SharedTask(promise_type* promise) : promise_(promise) {
+    }
+
+    promise_type* promise_ = nullptr;
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "epoch.h"
+#include "shared.h"
+
+// Multi-version cell: a newest-first chain of SharedPtr snapshots tagged with commit timestamps.
+// A reader takes a Snapshot and sees the newest version committed at or before it, without
+// locks. Writers are serialized; after each commit the versions that no registered snapshot can
+// see any more are unlinked and retired through EpochDomain, since readers may still be
+// walking them.
+template <typename T>
+class VersionedShared {
+public:
+    static constexpr size_t kMaxSnapshots = 128;
+
+    // Registration of a point-in-time view; must not outlive the cell
+    class Snapshot {
+    public:
+        Snapshot(Snapshot&& other) : slot_(other.slot_), timestamp_(other.timestamp_) {
+            other.slot_ = nullptr;
+        }
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        Snapshot& operator=(Snapshot&&) = delete;
+
+        ~Snapshot() {
+            if (slot_) {
+                slot_->store(kFree, std::memory_order_release);
+            }
+        }
+
+        uint64_t Timestamp() const {
+            return timestamp_;
+        }
+
+    private:
+        friend class VersionedShared;
+
+        Snapshot(std::atomic<uint64_t>* slot, uint64_t timestamp) : slot_(slot), timestamp_(timestamp) {
+        }
+
+        std::atomic<uint64_t>* slot_;
+        uint64_t timestamp_;
+    };
+
+    explicit VersionedShared(SharedPtr<const T> initial) : head_(new Node{0, std::move(initial)}) {
+        for (auto& slot : snapshots_) {
+            slot.store(kFree, std::memory_order_relaxed);
+        }
+    }
+
+    VersionedShared(const VersionedShared&) = delete;
+    VersionedShared& operator=(const VersionedShared&) = delete;
+
+    ~VersionedShared() {
+        Node* node = head_.load(std::memory_order_relaxed);
+        while (node) {
+            Node* next = node->next.load(std::memory_order_relaxed);
+            delete node;
+            node = next;
+        }
+    }
+
+    Snapshot TakeSnapshot() {
+        for (size_t spins = 0;; ++spins) {
+            for (auto& slot : snapshots_) {
+                uint64_t expected = kFree;
+                if (slot.load(std::memory_order_relaxed) != kFree) {
+                    continue;
+                }
+                uint64_t timestamp = clock_.load(std::memory_order_seq_cst);
+                if (!slot.compare_exchange_strong(expected, timestamp, std::memory_order_seq_cst)) {
+                    continue;
+                }
+                // A commit that did not see the registration may have pruned our version already,
+                // in which case move up to the newer timestamp
+                for (uint64_t current; (current = clock_.load(std::memory_order_seq_cst)) != timestamp;) {
+                    timestamp = current;
+                    slot.store(timestamp, std::memory_order_seq_cst);
+                }
+                return Snapshot(&slot, timestamp);
+            }
+            // Every slot is taken, wait for a reader to finish
+            std::this_thread::yield();
+        }
+    }
+
+    // Newest version committed at or before the snapshot
+    SharedPtr<const T> Read(const Snapshot& snapshot) const {
+        EpochDomain::Guard guard;
+        Node* node = head_.load(std::memory_order_acquire);
+        while (node->timestamp > snapshot.Timestamp()) {
+            node = node->next.load(std::memory_order_acquire);
+        }
+        return node->value;
+    }
+
+    SharedPtr<const T> ReadLatest() const {
+        EpochDomain::Guard guard;
+        return head_.load(std::memory_order_acquire)->value;
+    }
+
+    // Publishes a new version, returns its commit timestamp
+    uint64_t Commit(SharedPtr<const T> value) {
+        EpochDomain::DeferredCollect collect;
+        std::lock_guard lock(mutex_);
+        uint64_t timestamp = clock_.load(std::memory_order_relaxed) + 1;
+        Node* node = new Node{timestamp, std::move(value)};
+        node->next.store(head_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        head_.store(node, std::memory_order_release);
+        clock_.store(timestamp, std::memory_order_seq_cst);
+
+        Prune(timestamp);
+        return timestamp;
+    }
+
+    // Versions currently kept alive
+    size_t VersionCount() const {
+        std::lock_guard lock(mutex_);
+        size_t count = 0;
+        for (Node* node = head_.load(std::memory_order_relaxed); node;
+             node = node->next.load(std::memory_order_relaxed)) {
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    static constexpr uint64_t kFree = UINT64_MAX;
+
+    struct Node {
+        Node(uint64_t timestamp, SharedPtr<const T> value) : timestamp(timestamp), value(std::move(value)) {
+        }
+
+        uint64_t timestamp;
+        SharedPtr<const T> value;
+        std::atomic<Node*> next{nullptr};
+    };
+
+    // Keeps everything visible to the oldest registered snapshot, called under the writer lock
+    void Prune(uint64_t oldest) {
+        for (auto& slot : snapshots_) {
+            uint64_t timestamp = slot.load(std::memory_order_seq_cst);
+            if (timestamp < oldest) {
+                oldest = timestamp;
+            }
+        }
+
+        Node* node = head_.load(std::memory_order_relaxed);
+        while (node->timestamp > oldest) {
+            node = node->next.load(std::memory_order_relaxed);
+        }
+        Node* garbage = node->next.exchange(nullptr, std::memory_order_acq_rel);
+        while (garbage) {
+            Node* next = garbage->next.load(std::memory_order_relaxed);
+            EpochDomain::Global().Retire(garbage);
+            garbage = next;
+        }
+    }
+
+    std::atomic<Node*> head_;
+    std::atomic<uint64_t> clock_{0};
+    mutable std::mutex mutex_;
+    std::atomic<uint64_t> snapshots_[kMaxSnapshots];
+};